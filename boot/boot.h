@@ -0,0 +1,26 @@
+#ifndef JOS_BOOT_BOOT_H
+#define JOS_BOOT_BOOT_H
+
+#include <inc/types.h>
+
+// Definitions shared by the pieces of the second-stage boot loader.
+
+#define SECTSIZE	512
+#define MAXSECTS	256	// most sectors one disk command moves
+
+// The kernel image follows the boot sector and the second stage.
+#define KERNSECT	(1 + BOOT2_NSECT)
+
+// LZ4 decompression in place needs the compressed data to end this
+// far past the end of the output.
+#define LZ4_INPLACE_MARGIN(srclen)	(((srclen) >> 8) + 32)
+
+// boot/ide.c
+void	ide_init(void);
+bool	ide_dma(void);
+void	ide_read(void *dst, uint32_t secno, uint32_t nsect);
+
+// boot/lz4.c
+uint32_t lz4_decompress(uint8_t *dst, const uint8_t *src, uint32_t srclen);
+
+#endif /* !JOS_BOOT_BOOT_H */
@@ -0,0 +1,194 @@
+#include <inc/x86.h>
+
+#include <boot/boot.h>
+
+/**********************************************************************
+ * Disk access for the second-stage boot loader.
+ *
+ * We read from the master drive on the primary ATA channel through its
+ * legacy ports.  If the channel sits behind a PCI bus-master IDE
+ * controller (QEMU's PIIX does), whole runs of sectors are moved with
+ * READ DMA and the CPU only waits for the transfer to finish.
+ * Otherwise, or if a DMA transfer fails, we fall back to PIO.
+ **********************************************************************/
+
+#define IDE_DATA	0x1F0
+#define IDE_NSECT	0x1F2
+#define IDE_LBA0	0x1F3
+#define IDE_LBA1	0x1F4
+#define IDE_LBA2	0x1F5
+#define IDE_DRIVE	0x1F6
+#define IDE_STATUS	0x1F7	// In
+#define IDE_CMD		0x1F7	// Out
+#define   IDE_BSY	0x80
+#define   IDE_DRDY	0x40
+#define   IDE_DF	0x20
+#define   IDE_ERR	0x01
+
+#define IDE_CMD_READ		0x20
+#define IDE_CMD_READ_DMA	0xC8
+
+#define PCI_CONF_ADDR	0xCF8
+#define PCI_CONF_DATA	0xCFC
+
+// Bus-master IDE registers for the primary channel, relative to BAR4
+#define BM_CMD		0
+#define   BM_CMD_START	0x01
+#define   BM_CMD_READ	0x08	// transfer from device to memory
+#define BM_STATUS	2
+#define   BM_ST_ACTIVE	0x01
+#define   BM_ST_ERR	0x02
+#define   BM_ST_INTR	0x04
+#define BM_PRDT		4
+
+// Physical region descriptor: one piece of a DMA buffer, which may not
+// cross a 64KB boundary.  A byte count of 0 means 64KB.
+struct Prd {
+	uint32_t prd_addr;
+	uint16_t prd_count;
+	uint16_t prd_flags;
+};
+#define PRD_EOT		0x8000
+
+// A MAXSECTS transfer spans at most three 64KB regions.  Aligning the
+// table to its own size keeps it from crossing a 64KB boundary too.
+static struct Prd prdt[4] __attribute__((__aligned__(32)));
+
+static uint16_t bmbase;		// bus-master register base, 0 if no DMA
+
+static int
+waitdisk(void)
+{
+	int r;
+
+	// wait for disk ready
+	while (((r = inb(IDE_STATUS)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+		/* do nothing */;
+	return r;
+}
+
+static uint32_t
+pci_conf_read(uint32_t devfn, uint32_t reg)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | (devfn << 8) | reg);
+	return inl(PCI_CONF_DATA);
+}
+
+static void
+pci_conf_write(uint32_t devfn, uint32_t reg, uint32_t v)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | (devfn << 8) | reg);
+	outl(PCI_CONF_DATA, v);
+}
+
+// Look on PCI bus 0 for a bus-master IDE controller whose primary
+// channel is in compatibility mode (i.e., at the ports above), and
+// enable bus mastering on it.
+void
+ide_init(void)
+{
+	uint32_t devfn, class, bar;
+
+	for (devfn = 0; devfn < 32 * 8; devfn++) {
+		if ((pci_conf_read(devfn, 0x00) & 0xFFFF) == 0xFFFF)
+			continue;
+		// class code, subclass, programming interface
+		class = pci_conf_read(devfn, 0x08) >> 8;
+		if ((class >> 8) != 0x0101 || (class & 0x81) != 0x80)
+			continue;
+		bar = pci_conf_read(devfn, 0x20);
+		if (!(bar & 1))
+			continue;
+		// enable I/O space and bus mastering
+		pci_conf_write(devfn, 0x04, pci_conf_read(devfn, 0x04) | 0x05);
+		bmbase = bar & 0xFFFC;
+		return;
+	}
+}
+
+// Are reads going through DMA?
+bool
+ide_dma(void)
+{
+	return bmbase != 0;
+}
+
+static void
+ide_command(int cmd, uint32_t secno, uint32_t nsect)
+{
+	waitdisk();
+
+	outb(IDE_NSECT, nsect);		// count; 0 means 256
+	outb(IDE_LBA0, secno);
+	outb(IDE_LBA1, secno >> 8);
+	outb(IDE_LBA2, secno >> 16);
+	outb(IDE_DRIVE, (secno >> 24) | 0xE0);
+	outb(IDE_CMD, cmd);
+}
+
+static int
+ide_read_dma(uint32_t pa, uint32_t secno, uint32_t nsect)
+{
+	struct Prd *p;
+	uint32_t len, n;
+	int st, r;
+
+	// Describe the buffer, splitting it at 64KB boundaries.
+	for (p = prdt, len = nsect * SECTSIZE; len > 0; p++) {
+		n = 0x10000 - (pa & 0xFFFF);
+		if (n > len)
+			n = len;
+		p->prd_addr = pa;
+		p->prd_count = n;
+		p->prd_flags = 0;
+		pa += n;
+		len -= n;
+	}
+	p[-1].prd_flags = PRD_EOT;
+
+	outl(bmbase + BM_PRDT, (uint32_t) prdt);
+	outb(bmbase + BM_STATUS, BM_ST_ERR | BM_ST_INTR);	// write 1 to clear
+	outb(bmbase + BM_CMD, BM_CMD_READ);
+	ide_command(IDE_CMD_READ_DMA, secno, nsect);
+	outb(bmbase + BM_CMD, BM_CMD_READ | BM_CMD_START);
+
+	// Interrupts are off; just watch the engine until it stops.
+	while (((st = inb(bmbase + BM_STATUS))
+		& (BM_ST_ACTIVE | BM_ST_ERR | BM_ST_INTR)) == BM_ST_ACTIVE)
+		/* do nothing */;
+	outb(bmbase + BM_CMD, 0);
+
+	r = waitdisk();
+	if ((st & BM_ST_ERR) || (r & (IDE_DF | IDE_ERR)))
+		return -1;
+	return 0;
+}
+
+static void
+ide_read_pio(uint8_t *dst, uint32_t secno, uint32_t nsect)
+{
+	ide_command(IDE_CMD_READ, secno, nsect);
+
+	// The drive raises DRQ once per sector; drain each one
+	// as soon as it is ready.
+	while (nsect-- > 0) {
+		waitdisk();
+		insl(IDE_DATA, dst, SECTSIZE/4);
+		dst += SECTSIZE;
+	}
+}
+
+// Read 'nsect' (1 to MAXSECTS) consecutive sectors starting at sector
+// 'secno' into 'dst' with a single disk command.
+void
+ide_read(void *dst, uint32_t secno, uint32_t nsect)
+{
+	// Since we haven't enabled paging yet and we're using
+	// an identity segment mapping (see boot.S), we can
+	// hand physical addresses straight to the DMA engine.
+	if (bmbase && ide_read_dma((uint32_t) dst, secno, nsect) == 0)
+		return;
+	// Give up on DMA for the rest of the boot.
+	bmbase = 0;
+	ide_read_pio(dst, secno, nsect);
+}
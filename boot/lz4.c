@@ -0,0 +1,44 @@
+#include <boot/boot.h>
+
+// Decompress the LZ4 block of 'srclen' bytes at 'src' into 'dst'
+// and return the number of bytes produced.
+//
+// The block is trusted (it was written by boot/lz4pack.c), so there
+// is no bounds checking.  Decompression may run in place: 'src' may
+// sit inside the output buffer as long as it ends at least
+// LZ4_INPLACE_MARGIN(srclen) bytes past the end of the output.
+uint32_t
+lz4_decompress(uint8_t *dst, const uint8_t *src, uint32_t srclen)
+{
+	const uint8_t *send = src + srclen;
+	const uint8_t *m;
+	uint8_t *d = dst;
+	uint32_t token, len, b;
+
+	while (src < send) {
+		token = *src++;
+
+		// literals
+		len = token >> 4;
+		if (len == 15)
+			do {
+				len += (b = *src++);
+			} while (b == 255);
+		while (len-- > 0)
+			*d++ = *src++;
+		if (src >= send)
+			break;		// the last sequence has no match
+
+		// match: may overlap the bytes it produces
+		m = d - (src[0] | (src[1] << 8));
+		src += 2;
+		len = token & 15;
+		if (len == 15)
+			do {
+				len += (b = *src++);
+			} while (b == 255);
+		for (len += 4; len > 0; len--)
+			*d++ = *m++;
+	}
+	return d - dst;
+}
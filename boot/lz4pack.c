@@ -0,0 +1,203 @@
+// Build-time tool: rewrite the kernel ELF image so that each loadable
+// segment is stored as an LZ4 block, for boot/main.c to decompress.
+//
+// Usage: lz4pack kernel kernel.lz4
+//
+// The output keeps the ELF and program headers (section headers are
+// dropped; debuggers should use the original kernel).  A compressed
+// segment is marked with ELF_PROG_FLAG_LZ4, starts on a sector
+// boundary, and has p_filesz set to the compressed size.  Segments
+// that don't shrink are stored as is.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Prevent inc/types.h, included from inc/elf.h, from attempting
+// to redefine types defined in the host's stdint.h.
+#define JOS_INC_TYPES_H
+
+#include <inc/elf.h>
+
+#define SECTSIZE	512
+
+// LZ4 block format limits: the last match must start at least MFLIMIT
+// bytes before the end of the block and the last LASTLITERALS bytes
+// are always literals.  Keeping to them also makes the block safe to
+// decompress in place (see boot/main.c).
+#define MINMATCH	4
+#define MFLIMIT		12
+#define LASTLITERALS	5
+#define MAXOFFSET	65535
+
+#define HASHLOG		12
+
+static uint32_t
+read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint32_t
+hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - HASHLOG);
+}
+
+static uint8_t *
+putlen(uint8_t *op, uint32_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+static uint8_t *
+putseq(uint8_t *op, const uint8_t *lit, uint32_t nlit,
+       uint32_t offset, uint32_t mlen)
+{
+	uint8_t *token = op++;
+
+	*token = (nlit < 15 ? nlit : 15) << 4;
+	if (nlit >= 15)
+		op = putlen(op, nlit - 15);
+	memcpy(op, lit, nlit);
+	op += nlit;
+	if (mlen == 0)		// last sequence: literals only
+		return op;
+
+	*op++ = offset;
+	*op++ = offset >> 8;
+	mlen -= MINMATCH;
+	*token |= mlen < 15 ? mlen : 15;
+	if (mlen >= 15)
+		op = putlen(op, mlen - 15);
+	return op;
+}
+
+// Greedy single-pass LZ4 block compressor.
+// 'dst' must have room for lz4_bound(n) bytes.  Returns the block size.
+static uint32_t
+lz4_compress(const uint8_t *src, uint32_t n, uint8_t *dst)
+{
+	static int32_t table[1 << HASHLOG];
+	uint32_t ip = 0, anchor = 0, ref, mlen, h;
+	uint8_t *op = dst;
+
+	memset(table, 0xFF, sizeof(table));
+	while (n >= MFLIMIT + 1 && ip < n - MFLIMIT) {
+		h = hash(read32(src + ip));
+		ref = table[h];
+		table[h] = ip;
+		if (ref == (uint32_t) -1 || ip - ref > MAXOFFSET
+		    || read32(src + ref) != read32(src + ip)) {
+			ip++;
+			continue;
+		}
+		for (mlen = MINMATCH;
+		     ip + mlen < n - LASTLITERALS && src[ref + mlen] == src[ip + mlen];
+		     mlen++)
+			/* do nothing */;
+		op = putseq(op, src + anchor, ip - anchor, ip - ref, mlen);
+		ip += mlen;
+		anchor = ip;
+	}
+	op = putseq(op, src + anchor, n - anchor, 0, 0);
+	return op - dst;
+}
+
+static uint32_t
+lz4_bound(uint32_t n)
+{
+	return n + n / 255 + 16;
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *f;
+	uint8_t *in, *out, *z;
+	long insize;
+	uint32_t off, zsize, rawtotal = 0, ztotal = 0;
+	struct Elf *elf;
+	struct Proghdr *ph;
+	int i;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: lz4pack kernel kernel.lz4\n");
+		exit(2);
+	}
+
+	if ((f = fopen(argv[1], "rb")) == NULL) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	insize = ftell(f);
+	rewind(f);
+	in = malloc(insize);
+	if (fread(in, 1, insize, f) != insize) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fclose(f);
+
+	elf = (struct Elf *) in;
+	if (insize < sizeof(*elf) || elf->e_magic != ELF_MAGIC) {
+		fprintf(stderr, "%s: not an ELF file\n", argv[1]);
+		exit(1);
+	}
+
+	// The headers go first, untouched except for the program headers
+	// and the (now meaningless) section header table.
+	out = calloc(1, insize + SECTSIZE * (elf->e_phnum + 1)
+		     + lz4_bound(insize));
+	off = elf->e_phoff + elf->e_phnum * sizeof(struct Proghdr);
+	memcpy(out, in, off);
+	elf = (struct Elf *) out;
+	elf->e_shoff = 0;
+	elf->e_shnum = 0;
+	elf->e_shstrndx = 0;
+
+	z = malloc(lz4_bound(insize));
+	ph = (struct Proghdr *) (out + elf->e_phoff);
+	for (i = 0; i < elf->e_phnum; i++, ph++) {
+		if (ph->p_type != ELF_PROG_LOAD || ph->p_filesz == 0)
+			continue;
+		if (ph->p_offset + ph->p_filesz > insize) {
+			fprintf(stderr, "%s: truncated segment\n", argv[1]);
+			exit(1);
+		}
+		rawtotal += ph->p_filesz;
+		zsize = lz4_compress(in + ph->p_offset, ph->p_filesz, z);
+		if (zsize < ph->p_filesz) {
+			// compressed: sector-aligned on disk
+			off = (off + SECTSIZE - 1) & ~(SECTSIZE - 1);
+			memcpy(out + off, z, zsize);
+			ph->p_offset = off;
+			ph->p_filesz = zsize;
+			ph->p_flags |= ELF_PROG_FLAG_LZ4;
+		} else {
+			// raw: keep the file offset congruent to the load
+			// address modulo the sector size, as the loader wants
+			off += (ph->p_pa - off) & (SECTSIZE - 1);
+			memcpy(out + off, in + ph->p_offset, ph->p_filesz);
+			ph->p_offset = off;
+		}
+		off += ph->p_filesz;
+		ztotal += ph->p_filesz;
+	}
+
+	if ((f = fopen(argv[2], "wb")) == NULL
+	    || fwrite(out, 1, off, f) != off || fclose(f) != 0) {
+		perror(argv[2]);
+		exit(1);
+	}
+	printf("lz4pack: %u bytes of segments -> %u\n", rawtotal, ztotal);
+	return 0;
+}
@@ -1,15 +1,21 @@
 #include <inc/x86.h>
 #include <inc/elf.h>
+#include <inc/bootinfo.h>
+
+#include <boot/boot.h>
 
 /**********************************************************************
  * This a dirt simple boot loader, whose sole job is to boot
  * an ELF kernel image from the first IDE hard disk.
  *
  * DISK LAYOUT
- *  * This program(boot.S and main.c) is the bootloader.  It should
- *    be stored in the first sector of the disk.
+ *  * boot.S is the first-stage boot loader.  It must fit, with its
+ *    signature, in the first sector of the disk.
+ *
+ *  * The next BOOT2_NSECT sectors hold the second stage: boot2.S,
+ *    this file and ide.c.
  *
- *  * The 2nd sector onward holds the kernel image.
+ *  * The sectors after that (from KERNSECT on) hold the kernel image.
  *
  *  * The kernel image must be in ELF format.
  *
@@ -23,22 +29,43 @@
  *  * Assuming this boot loader is stored in the first sector of the
  *    hard-drive, this code takes over...
  *
- *  * control starts in boot.S -- which sets up protected mode,
- *    and a stack so C code then run, then calls bootmain()
+ *  * control starts in boot.S -- which reads in the second stage with
+ *    the BIOS, sets up protected mode, and a stack so C code then run,
+ *    then calls the second stage's entry point in boot2.S
+ *
+ *  * boot2.S clears the second stage's BSS and calls bootmain()
  *
  *  * bootmain() in this file takes over, reads in the kernel and jumps to it.
  **********************************************************************/
 
-#define SECTSIZE	512
 #define ELFHDR		((struct Elf *) 0x10000) // scratch space
+#define BOOTINFO	((struct Bootinfo *) BOOTINFO_ADDR)
+
+// Read across a gap of up to this many bytes between two segments
+// rather than issue another disk command.
+#define MERGEGAP	(SECTSIZE*8)
 
-void readsect(void*, uint32_t);
 void readseg(uint32_t, uint32_t, uint32_t);
+static struct Proghdr *readrun(struct Proghdr *, struct Proghdr *);
+static void readseg_lz4(struct Proghdr *);
+static void zero(uint32_t, uint32_t);
+static void stamp(int, int);
 
 void
 bootmain(void)
 {
-	struct Proghdr *ph, *eph;
+	struct Proghdr *ph, *ph0, *eph;
+
+	BOOTINFO->bi_magic = BOOTINFO_MAGIC;
+	BOOTINFO->bi_nstamp = 0;
+	stamp(BS_BOOTMAIN, 0);
+	BOOTINFO->bi_load_start = BOOTINFO->bi_stamp[0].bs_tsc;
+	BOOTINFO->bi_load_bytes = 0;
+	BOOTINFO->bi_load_flags = 0;
+	BOOTINFO->bi_raw_bytes = 0;
+	BOOTINFO->bi_lz4_cycles = 0;
+
+	ide_init();
 
 	// read 1st page off disk
 	readseg((uint32_t) ELFHDR, SECTSIZE*8, 0);
@@ -47,13 +74,25 @@ bootmain(void)
 	if (ELFHDR->e_magic != ELF_MAGIC)
 		goto bad;
 
-	// load each program segment (ignores ph flags)
-	ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
+	// load each loadable program segment
+	ph0 = ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
 	eph = ph + ELFHDR->e_phnum;
-	for (; ph < eph; ph++)
-		// p_pa is the load address of this segment (as well
-		// as the physical address)
-		readseg(ph->p_pa, ph->p_memsz, ph->p_offset);
+	while (ph < eph) {
+		if (ph->p_type != ELF_PROG_LOAD) {
+			ph++;
+			continue;
+		}
+		if (ph->p_flags & ELF_PROG_FLAG_LZ4)
+			readseg_lz4(ph++);
+		else
+			ph = readrun(ph, eph);
+		// note the last segment just loaded
+		stamp(BS_SEGMENT, ph - 1 - ph0);
+	}
+
+	BOOTINFO->bi_load_end = read_tsc();
+	if (ide_dma())
+		BOOTINFO->bi_load_flags |= BI_LOAD_DMA;
 
 	// call the entry point from the ELF header
 	// note: does not return!
@@ -71,55 +110,119 @@ bad:
 void
 readseg(uint32_t pa, uint32_t count, uint32_t offset)
 {
-	uint32_t end_pa;
+	uint32_t end_pa, nsect;
 
 	end_pa = pa + count;
 
 	// round down to sector boundary
 	pa &= ~(SECTSIZE - 1);
 
-	// translate from bytes to sectors, and kernel starts at sector 1
-	offset = (offset / SECTSIZE) + 1;
+	// translate from bytes to sectors; the kernel starts at KERNSECT
+	offset = (offset / SECTSIZE) + KERNSECT;
 
-	// If this is too slow, we could read lots of sectors at a time.
+	// Read up to MAXSECTS sectors per disk command.
 	// We'd write more to memory than asked, but it doesn't matter --
 	// we load in increasing order.
 	while (pa < end_pa) {
-		// Since we haven't enabled paging yet and we're using
-		// an identity segment mapping (see boot.S), we can
-		// use physical addresses directly.  This won't be the
-		// case once JOS enables the MMU.
-		readsect((uint8_t*) pa, offset);
-		pa += SECTSIZE;
-		offset++;
+		nsect = (end_pa - pa + SECTSIZE - 1) / SECTSIZE;
+		if (nsect > MAXSECTS)
+			nsect = MAXSECTS;
+		ide_read((uint8_t*) pa, offset, nsect);
+		BOOTINFO->bi_load_bytes += nsect * SECTSIZE;
+		pa += nsect * SECTSIZE;
+		offset += nsect;
 	}
 }
 
-void
-waitdisk(void)
+// Load the uncompressed segment 'ph', along with any segments after it
+// (up to 'eph') that follow it on disk just as they do in memory, with
+// one contiguous read.  Only the file-backed part of each segment is
+// read; the rest (its BSS) is zeroed.  Returns the next segment to load.
+static struct Proghdr *
+readrun(struct Proghdr *ph, struct Proghdr *eph)
 {
-	// wait for disk reaady
-	while ((inb(0x1F7) & 0xC0) != 0x40)
-		/* do nothing */;
-}
+	struct Proghdr *run;
+	uint32_t end;
+
+	end = ph->p_offset + ph->p_filesz;
+	for (run = ph + 1; run < eph; run++) {
+		if (run->p_type != ELF_PROG_LOAD
+		    || (run->p_flags & ELF_PROG_FLAG_LZ4)
+		    || run->p_offset < end
+		    || run->p_offset - end > MERGEGAP
+		    || run->p_offset - ph->p_offset != run->p_pa - ph->p_pa)
+			break;
+		end = run->p_offset + run->p_filesz;
+	}
 
-void
-readsect(void *dst, uint32_t offset)
-{
-	// wait for disk to be ready
-	waitdisk();
+	// p_pa is the load address of this segment (as well
+	// as the physical address)
+	readseg(ph->p_pa, end - ph->p_offset, ph->p_offset);
 
-	outb(0x1F2, 1);		// count = 1
-	outb(0x1F3, offset);
-	outb(0x1F4, offset >> 8);
-	outb(0x1F5, offset >> 16);
-	outb(0x1F6, (offset >> 24) | 0xE0);
-	outb(0x1F7, 0x20);	// cmd 0x20 - read sectors
+	// The read also covered the gaps between segments; clear
+	// each one's BSS only afterwards.
+	for (; ph < run; ph++) {
+		zero(ph->p_pa + ph->p_filesz, ph->p_memsz - ph->p_filesz);
+		BOOTINFO->bi_raw_bytes += ph->p_filesz;
+	}
+	return run;
+}
 
-	// wait for disk to be ready
-	waitdisk();
+// Load a segment stored as an LZ4 block (see boot/lz4pack.c).
+// The block is read to the top of the segment's memory, past its end
+// by the in-place margin, and decompressed down into place.  This
+// scribbles over memory above the segment, but it doesn't matter --
+// we load in increasing order.
+static void
+readseg_lz4(struct Proghdr *ph)
+{
+	uint32_t src, n;
+	uint64_t t;
+
+	src = ROUNDUP(ph->p_pa + ph->p_memsz
+		      + LZ4_INPLACE_MARGIN(ph->p_filesz) - ph->p_filesz,
+		      SECTSIZE);
+	readseg(src, ph->p_filesz, ph->p_offset);
+
+	t = read_tsc();
+	n = lz4_decompress((uint8_t *) ph->p_pa, (uint8_t *) src, ph->p_filesz);
+	BOOTINFO->bi_lz4_cycles += read_tsc() - t;
+	BOOTINFO->bi_raw_bytes += n;
+	BOOTINFO->bi_load_flags |= BI_LOAD_LZ4;
+
+	// the rest of the segment still holds compressed data
+	zero(ph->p_pa + n, ph->p_memsz - n);
+}
 
-	// read a sector
-	insl(0x1F0, dst, SECTSIZE/4);
+// Add a timestamp to the boot timeline.
+static void
+stamp(int what, int arg)
+{
+	struct Bootstamp *bs;
+
+	if (BOOTINFO->bi_nstamp == BI_NSTAMP)
+		return;
+	bs = &BOOTINFO->bi_stamp[BOOTINFO->bi_nstamp++];
+	bs->bs_tsc = read_tsc();
+	bs->bs_what = what;
+	bs->bs_arg = arg;
 }
 
+// Zero 'count' bytes at physical address 'pa': byte stores up to a
+// word boundary, word stores for the bulk, byte stores for the rest.
+static void
+zero(uint32_t pa, uint32_t count)
+{
+	uint32_t n;
+
+	n = MIN(-pa & 3, count);
+	count -= n;
+	asm volatile("cld; rep stosb"
+		: "+D" (pa), "+c" (n) : "a" (0) : "cc", "memory");
+	n = count / 4;
+	asm volatile("rep stosl"
+		: "+D" (pa), "+c" (n) : "a" (0) : "cc", "memory");
+	n = count & 3;
+	asm volatile("rep stosb"
+		: "+D" (pa), "+c" (n) : "a" (0) : "cc", "memory");
+}
@@ -18,3 +18,14 @@ V = @
 # following line and set it to the full path to QEMU.
 #
 # QEMU=
+
+# If KERN_LZ4 is set, kernel.img holds the kernel with each loadable
+# segment LZ4-compressed, and the boot loader decompresses it.  Fewer
+# sectors to read makes for a faster boot.
+#
+# KERN_LZ4 = 1
+
+# COM_BAUD sets the serial console's baud rate (default 9600).  It must
+# divide 115200.  The monitor's 'cons baud' command changes it at run time.
+#
+# COM_BAUD = 115200
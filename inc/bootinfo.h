@@ -0,0 +1,45 @@
+#ifndef JOS_INC_BOOTINFO_H
+#define JOS_INC_BOOTINFO_H
+
+#include <inc/types.h>
+
+// The boot loader leaves a few facts about the boot in this structure
+// for the kernel.  It lives at a fixed physical address in conventional
+// memory, well below the boot loader's stack (which grows down from
+// 0x7c00), so the kernel must read it before reusing low memory.
+#define BOOTINFO_ADDR	0x7000
+#define BOOTINFO_MAGIC	0xB0071AF0
+
+// Boot timeline: TSC timestamps taken at points along the way, first
+// by the boot loader and then by the kernel, in order.
+#define BI_NSTAMP	16
+
+struct Bootstamp {
+	uint64_t bs_tsc;
+	uint16_t bs_what;		// BS_* below
+	uint16_t bs_arg;		// BS_SEGMENT: index of the segment
+};
+
+#define BS_BOOTMAIN	1		// boot loader's bootmain() entered
+#define BS_SEGMENT	2		// boot loader loaded a segment
+#define BS_ENTRY	3		// kernel entry point (entry.S)
+#define BS_I386_INIT	4		// i386_init() entered
+#define BS_CONS_INIT	5		// console initialized
+#define BS_MONITOR	6		// first kernel monitor prompt
+
+struct Bootinfo {
+	uint32_t bi_magic;		// BOOTINFO_MAGIC if the rest is valid
+	uint64_t bi_load_start;		// TSC before the kernel is read
+	uint64_t bi_load_end;		// TSC after the last segment is read
+	uint32_t bi_load_bytes;		// bytes moved from disk for the kernel
+	uint32_t bi_load_flags;		// BI_LOAD_* below
+	uint32_t bi_raw_bytes;		// segment bytes, after decompression
+	uint64_t bi_lz4_cycles;		// TSC cycles spent decompressing
+	uint32_t bi_nstamp;		// entries used in bi_stamp
+	struct Bootstamp bi_stamp[BI_NSTAMP];
+};
+
+#define BI_LOAD_DMA	0x1		// kernel was read with bus-master DMA
+#define BI_LOAD_LZ4	0x2		// some segments were LZ4-compressed
+
+#endif /* !JOS_INC_BOOTINFO_H */
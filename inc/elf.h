@@ -52,6 +52,8 @@ struct Secthdr {
 #define ELF_PROG_FLAG_EXEC	1
 #define ELF_PROG_FLAG_WRITE	2
 #define ELF_PROG_FLAG_READ	4
+// (JOS-specific) segment is stored as an LZ4 block; see boot/lz4pack.c
+#define ELF_PROG_FLAG_LZ4	0x00100000
 
 // Values for Secthdr::sh_type
 #define ELF_SHT_NULL		0
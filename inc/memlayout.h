@@ -80,6 +80,10 @@
  * (*) Note: The kernel ensures that "Invalid Memory" is *never* mapped.
  *     "Empty Memory" is normally unmapped, but user programs may map pages
  *     there if desired.  JOS user programs map pages temporarily at UTEMP.
+ *
+ * Everything above ULIM is the same in every address space, so the kernel
+ * maps it with PTE_G: those TLB entries survive the CR3 reload of an
+ * address space switch.  UVPT and below must never be global.
  */
 
 
@@ -1,6 +1,7 @@
 #ifndef JOS_INC_STDIO_H
 #define JOS_INC_STDIO_H
 
+#include <inc/types.h>
 #include <inc/stdarg.h>
 
 #ifndef NULL
@@ -12,15 +13,51 @@ void	cputchar(int c);
 int	getchar(void);
 int	iscons(int fd);
 
+// A format string compiled by vprintfmt_cached: runs of literal text
+// and pre-parsed conversions
+#define FMT_MAXOPS	16
+
+struct Fmtop {
+	const char *fo_str;	// literal text, or the escape after its '%'
+	uint16_t fo_len;	// length of the literal text; 0 for an escape
+	char fo_conv;		// conversion; '*' means parse fo_str each time
+	char fo_padc;
+	int8_t fo_lflag;
+	int8_t fo_altflag;
+	char fo_ext;		// 'h' or 'N' for %ph or %phN
+	int16_t fo_width;
+	int16_t fo_precision;
+};
+
+struct Fmtcache {
+	const char *fc_fmt;	// format compiled into fc_ops, or NULL
+	int fc_nops;		// -1 if fc_fmt did not fit in fc_ops
+	struct Fmtop fc_ops[FMT_MAXOPS];
+};
+
 // lib/printfmt.c
 void	printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
 void	vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list);
+void	vprintfmt_bulk(void (*putch)(int, void*), void (*putbuf)(const char*, size_t, void*),
+		       void *putdat, const char *fmt, va_list);
+void	vprintfmt_cached(void (*putch)(int, void*), void (*putbuf)(const char*, size_t, void*),
+			 void *putdat, struct Fmtcache *fc, const char *fmt, va_list);
 int	snprintf(char *str, int size, const char *fmt, ...);
 int	vsnprintf(char *str, int size, const char *fmt, va_list);
 
 // lib/printf.c
 int	cprintf(const char *fmt, ...);
 int	vcprintf(const char *fmt, va_list);
+int	cprintf_cached(struct Fmtcache *fc, const char *fmt, ...);
+int	vcprintf_cached(struct Fmtcache *fc, const char *fmt, va_list);
+
+// cprintf, with the format compiled once for this call site.
+// fmt must be a string literal.
+#define CPRINTF_CACHED(fmt, ...)					\
+({									\
+	static struct Fmtcache __fc;					\
+	cprintf_cached(&__fc, "" fmt, ##__VA_ARGS__);			\
+})
 
 // lib/fprintf.c
 int	printf(const char *fmt, ...);
@@ -22,4 +22,8 @@ void *	memfind(const void *s, int c, size_t len);
 
 long	strtol(const char *s, char **endptr, int base);
 
+#ifdef JOS_KERNEL
+void	string_init(void);
+#endif
+
 #endif /* not JOS_INC_STRING_H */
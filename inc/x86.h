@@ -227,9 +227,10 @@ static inline void
 cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp)
 {
 	uint32_t eax, ebx, ecx, edx;
+	// ecx = 0 selects the first subleaf of leaves that have them (7)
 	asm volatile("cpuid"
 		     : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
-		     : "a" (info));
+		     : "a" (info), "c" (0));
 	if (eaxp)
 		*eaxp = eax;
 	if (ebxp)
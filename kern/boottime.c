@@ -0,0 +1,88 @@
+// The boot timeline and other measurements the boot loader hands
+// over in the Bootinfo structure (see inc/bootinfo.h).
+
+#include <inc/stdio.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+
+#include <kern/boottime.h>
+#include <kern/tsc.h>
+
+static const char * const stamp_names[] = {
+	[BS_BOOTMAIN]	= "bootmain",
+	[BS_SEGMENT]	= "segment",
+	[BS_ENTRY]	= "entry",
+	[BS_I386_INIT]	= "i386_init",
+	[BS_CONS_INIT]	= "cons_init",
+	[BS_MONITOR]	= "monitor",
+};
+
+// Return the boot loader's Bootinfo, or NULL if it left none
+// (e.g., we were booted some other way).
+struct Bootinfo *
+bootinfo(void)
+{
+	struct Bootinfo *bi = (struct Bootinfo *) (KERNBASE + BOOTINFO_ADDR);
+
+	if (bi->bi_magic != BOOTINFO_MAGIC)
+		return NULL;
+	return bi;
+}
+
+const char *
+boot_stamp_name(int what)
+{
+	if (what < 0 || what >= ARRAY_SIZE(stamp_names) || !stamp_names[what])
+		return "?";
+	return stamp_names[what];
+}
+
+// Add an entry taken at TSC value 'tsc' to the boot timeline.
+void
+boot_stamp_at(int what, uint64_t tsc)
+{
+	struct Bootinfo *bi;
+	struct Bootstamp *bs;
+
+	if (!(bi = bootinfo()) || bi->bi_nstamp >= BI_NSTAMP)
+		return;
+	bs = &bi->bi_stamp[bi->bi_nstamp++];
+	bs->bs_tsc = tsc;
+	bs->bs_what = what;
+	bs->bs_arg = 0;
+}
+
+// Add an entry for right now to the boot timeline.
+void
+boot_stamp(int what)
+{
+	boot_stamp_at(what, read_tsc());
+}
+
+// Report what the boot loader measured while loading us, if anything.
+void
+boot_report(void)
+{
+	struct Bootinfo *bi;
+	uint64_t cycles, us;
+
+	if (!(bi = bootinfo()))
+		return;
+	cycles = bi->bi_load_end - bi->bi_load_start;
+	us = tsc_to_us(cycles);
+	cprintf("Boot loader read %uKB by %s in %llu cycles",
+		bi->bi_load_bytes / 1024,
+		bi->bi_load_flags & BI_LOAD_DMA ? "DMA" : "PIO", cycles);
+	if (us)
+		cprintf(" (%llu MB/s)", (uint64_t) bi->bi_load_bytes / us);
+	cprintf("\n");
+
+	// Compare with what reading the segments uncompressed would
+	// have cost, at the throughput the disk just achieved.
+	if (bi->bi_load_flags & BI_LOAD_LZ4)
+		cprintf("  LZ4: %uKB unpacked in %llu cycles; "
+			"raw load would take ~%llu cycles\n",
+			bi->bi_raw_bytes / 1024, bi->bi_lz4_cycles,
+			(cycles - bi->bi_lz4_cycles) * bi->bi_raw_bytes
+			/ bi->bi_load_bytes);
+}
@@ -0,0 +1,20 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_BOOTTIME_H
+#define JOS_KERN_BOOTTIME_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/bootinfo.h>
+
+// TSC at the kernel entry point, saved by entry.S
+extern uint64_t entry_tsc;
+
+struct Bootinfo *bootinfo(void);
+const char *boot_stamp_name(int what);
+void boot_stamp(int what);
+void boot_stamp_at(int what, uint64_t tsc);
+void boot_report(void);
+
+#endif	// !JOS_KERN_BOOTTIME_H
@@ -5,11 +5,17 @@
 #include <inc/kbdreg.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/trap.h>
 
 #include <kern/console.h>
+#include <kern/picirq.h>
+#include <kern/log.h>
+#include <kern/ktrace.h>
 
 static void cons_intr(int (*proc)(void));
-static void cons_putc(int c);
+static uint32_t cons_level(void);
+static void cga_sync(void);
 
 // Stupid I/O delay routine necessitated by historical PC design flaws
 static void
@@ -31,8 +37,16 @@ delay(void)
 #define COM_DLM		1	// Out: Divisor Latch High (DLAB=1)
 #define COM_IER		1	// Out: Interrupt Enable Register
 #define   COM_IER_RDI	0x01	//   Enable receiver data interrupt
+#define   COM_IER_TXI	0x02	//   Enable THR empty interrupt
+#define   COM_IER_MSI	0x08	//   Enable modem status interrupt
 #define COM_IIR		2	// In:	Interrupt ID Register
+#define   COM_IIR_NOPEND	0x01	//   No interrupt pending
+#define   COM_IIR_FIFO	0xC0	//   FIFOs enabled
 #define COM_FCR		2	// Out: FIFO Control Register
+#define   COM_FCR_ENABLE	0x01	//   Enable the FIFOs
+#define   COM_FCR_RCLR	0x02	//   Clear the receive FIFO
+#define   COM_FCR_TCLR	0x04	//   Clear the transmit FIFO
+#define   COM_FCR_TRIG8	0x80	//   Receive interrupt at 8 bytes
 #define COM_LCR		3	// Out: Line Control Register
 #define	  COM_LCR_DLAB	0x80	//   Divisor latch access bit
 #define	  COM_LCR_WLEN8	0x03	//   Wordlength: 8 bits
@@ -42,64 +56,292 @@ delay(void)
 #define	  COM_MCR_OUT2	0x08	// Out2 complement
 #define COM_LSR		5	// In:	Line Status Register
 #define   COM_LSR_DATA	0x01	//   Data available
+#define   COM_LSR_OE	0x02	//   Overrun error: a byte was lost
 #define   COM_LSR_TXRDY	0x20	//   Transmit buffer avail
 #define   COM_LSR_TSRE	0x40	//   Transmitter off
+#define COM_MSR		6	// In:	Modem Status Register
+#define   COM_MSR_CTS	0x10	//   Clear To Send
+
+#define COM_CLOCK	115200	// Divisor 1 runs at this baud rate
+#define COM_FIFOSZ	16	// Depth of a 16550's transmit FIFO
+
+// Default baud rate; can be set with COM_BAUD in conf/env.mk
+#ifndef COM_BAUD
+#define COM_BAUD	9600
+#endif
+#if COM_BAUD <= 0 || COM_BAUD > COM_CLOCK || COM_CLOCK % COM_BAUD != 0
+#error "COM_BAUD must divide 115200"
+#endif
 
 static bool serial_exists;
+static int serial_fifo;		// bytes we may send per TXRDY: 1, or 16
+static int serial_rate;
+
+// Input throttling.  When the input buffer passes CONS_HIWAT we stop
+// taking receive interrupts, so that further bytes wait in the UART,
+// until it falls below CONS_LOWAT.  With RTS/CTS flow control on we
+// also drop RTS meanwhile, asking the other end to stop sending, and
+// send only while the other end holds CTS up.  Flow control is off
+// unless the monitor's "cons flow on" turns it on: on a 3-wire line
+// CTS may float low, and we would never send anything.
+bool serial_flow = 0;
+static bool serial_throttled;
 
 static int
 serial_proc_data(void)
 {
-	if (!(inb(COM1+COM_LSR) & COM_LSR_DATA))
+	uint8_t lsr = inb(COM1+COM_LSR);
+
+	if (lsr & COM_LSR_OE)
+		cons_stat.cs_serial_overruns++;
+	if (!(lsr & COM_LSR_DATA))
 		return -1;
 	return inb(COM1+COM_RX);
 }
 
+// Stop (or restart) taking input from the other end
+static void
+serial_throttle(bool stop)
+{
+	outb(COM1+COM_MCR, COM_MCR_OUT2 | COM_MCR_DTR |
+	     (stop && serial_flow ? 0 : COM_MCR_RTS));
+	outb(COM1+COM_IER, COM_IER_TXI | COM_IER_MSI | (stop ? 0 : COM_IER_RDI));
+	if (stop && !serial_throttled)
+		cons_stat.cs_serial_throttles++;
+	serial_throttled = stop;
+}
+
+// Transmit ring.  serial_write() queues bytes here and the THR-empty
+// interrupt feeds them to the UART, so callers don't wait on the wire.
+// rpos and wpos run freely; both are only touched with interrupts off.
+#define SERIAL_TXBUFSIZE 4096
+
+static struct {
+	uint8_t buf[SERIAL_TXBUFSIZE];
+	uint32_t rpos;
+	uint32_t wpos;
+} serial_tx;
+
+int serial_policy = CONS_FULL_BLOCK;
+
+// Can the UART take a burst?  With the FIFO on, TXRDY means the whole
+// transmit FIFO is empty, not just one byte of it.
+static bool
+serial_ready(void)
+{
+	if (!(inb(COM1 + COM_LSR) & COM_LSR_TXRDY))
+		return 0;
+	return !serial_flow || (inb(COM1 + COM_MSR) & COM_MSR_CTS);
+}
+
+// Wait (for a while) until the UART can take a burst
+static void
+serial_wait(void)
+{
+	int i;
+
+	for (i = 0; !serial_ready() && i < 12800; i++)
+		delay();
+}
+
+// Move a FIFO's worth of bytes from the ring to the UART,
+// which the caller has checked is ready for them.
+static void
+serial_burst(void)
+{
+	int n;
+
+	for (n = 0; n < serial_fifo && serial_tx.rpos != serial_tx.wpos; n++)
+		outb(COM1 + COM_TX,
+		     serial_tx.buf[serial_tx.rpos++ % SERIAL_TXBUFSIZE]);
+	if (n > 0) {
+		cons_stat.cs_serial_bursts++;
+		cons_stat.cs_serial_bytes += n;
+	}
+}
+
+// Send everything in the ring, polling the UART rather than waiting
+// for interrupts.  Interrupts must be off.
+static void
+serial_drain(void)
+{
+	while (serial_tx.rpos != serial_tx.wpos) {
+		serial_wait();
+		serial_burst();
+	}
+}
+
 void
 serial_intr(void)
 {
-	if (serial_exists)
+	int i;
+
+	if (!serial_exists)
+		return;
+
+	// Service the UART until it has nothing pending.  The 8259A is
+	// edge-triggered, so a condition left pending would hold the
+	// interrupt line high and no further interrupts would arrive.
+	// Reading IIR acknowledges a THR-empty interrupt, and reading
+	// MSR a modem status one.  Input that the buffer has no room
+	// for stays pending until we mask the receive interrupt.
+	for (i = 0; i < 16; i++) {
+		(void) inb(COM1 + COM_MSR);
 		cons_intr(serial_proc_data);
+		if (!serial_throttled && cons_level() >= CONS_HIWAT)
+			serial_throttle(1);
+		if (serial_ready())
+			serial_burst();
+		if (inb(COM1 + COM_IIR) & COM_IIR_NOPEND)
+			break;
+	}
 }
 
+// Queue 'buf' for transmission.  If the ring fills, serial_policy says
+// whether to drop the rest of 'buf', wait for room, or drop the oldest
+// queued bytes.  Bytes may still be queued after we return; anything
+// that needs them out of the machine first (the monitor, before it
+// waits for input) calls cons_flush().
 static void
-serial_putc(int c)
+serial_write(const char *buf, size_t len, int attr)
 {
-	int i;
+	uint32_t eflags;
+	size_t i;
 
-	for (i = 0;
-	     !(inb(COM1 + COM_LSR) & COM_LSR_TXRDY) && i < 12800;
-	     i++)
-		delay();
+	if (!serial_exists)
+		return;
+
+	eflags = read_eflags();
+	asm volatile("cli");
+	for (i = 0; i < len; i++) {
+		if (serial_tx.wpos - serial_tx.rpos == SERIAL_TXBUFSIZE) {
+			if (serial_policy == CONS_FULL_DROP) {
+				cons_stat.cs_serial_dropped += len - i;
+				break;
+			} else if (serial_policy == CONS_FULL_OVERWRITE) {
+				serial_tx.rpos++;
+				cons_stat.cs_serial_dropped++;
+			} else {
+				// The interrupt can't run while we hold
+				// it off, so make room by hand
+				serial_wait();
+				serial_burst();
+			}
+		}
+		serial_tx.buf[serial_tx.wpos++ % SERIAL_TXBUFSIZE] = buf[i];
+	}
 
-	outb(COM1 + COM_TX, c);
+	// Start the transmitter if it is idle; the THR-empty interrupt
+	// takes it from there.  With interrupts off (early in boot, or
+	// after a panic) nothing would, so send it all now.
+	if (!(eflags & FL_IF))
+		serial_drain();
+	else if (serial_ready())
+		serial_burst();
+	write_eflags(eflags);
 }
 
+// Send everything queued for the serial port before returning.
 static void
-serial_init(void)
+serial_flush(void)
 {
-	// Turn off the FIFO
-	outb(COM1+COM_FCR, 0);
+	uint32_t eflags;
+
+	if (!serial_exists)
+		return;
+	eflags = read_eflags();
+	asm volatile("cli");
+	serial_drain();
+	write_eflags(eflags);
+}
+
+// Set the serial port's speed.
+// Returns 0 on success, < 0 if the port can't run at 'baud' bits/s.
+int
+serial_baud(int baud)
+{
+	uint32_t div, eflags;
+	int i;
+
+	if (baud <= 0 || baud > COM_CLOCK || COM_CLOCK % baud != 0)
+		return -E_INVAL;
+	div = COM_CLOCK / baud;
+
+	// Hold off the serial interrupt: with DLAB set, RX and THR read
+	// and write DLL, and IER is DLM
+	eflags = read_eflags();
+	asm volatile("cli");
+
+	// Let anything queued go out at the old speed, including the
+	// byte the shift register may still be sending after the FIFO
+	// has emptied
+	if (serial_exists)
+		serial_drain();
+	for (i = 0; serial_exists && !(inb(COM1+COM_LSR) & COM_LSR_TSRE) &&
+		     i < 12800; i++)
+		delay();
 
-	// Set speed; requires DLAB latch
+	// Requires DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_DLAB);
-	outb(COM1+COM_DLL, (uint8_t) (115200 / 9600));
-	outb(COM1+COM_DLM, 0);
+	outb(COM1+COM_DLL, (uint8_t) div);
+	outb(COM1+COM_DLM, (uint8_t) (div >> 8));
 
 	// 8 data bits, 1 stop bit, parity off; turn off DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_WLEN8 & ~COM_LCR_DLAB);
 
-	// No modem controls
-	outb(COM1+COM_MCR, 0);
-	// Enable rcv interrupts
-	outb(COM1+COM_IER, COM_IER_RDI);
+	serial_rate = baud;
+	write_eflags(eflags);
+	return 0;
+}
+
+int
+serial_getbaud(void)
+{
+	return serial_rate;
+}
+
+// Turn RTS/CTS flow control on or off.  Turning it off while input is
+// throttled raises RTS and takes receive interrupts again at once,
+// rather than when the input buffer happens to fall to CONS_LOWAT.
+void
+serial_setflow(bool on)
+{
+	uint32_t eflags;
+
+	eflags = read_eflags();
+	asm volatile("cli");
+	serial_flow = on;
+	if (!on && serial_exists)
+		serial_throttle(0);
+	write_eflags(eflags);
+}
+
+static void
+serial_init(void)
+{
+	// Turn on and clear the FIFOs
+	outb(COM1+COM_FCR, COM_FCR_ENABLE | COM_FCR_RCLR | COM_FCR_TCLR |
+	     COM_FCR_TRIG8);
+
+	// Set speed and word format; COM_BAUD was checked above
+	serial_baud(COM_BAUD);
+
+	// Raise DTR and RTS, and OUT2, which gates the UART's interrupt
+	// line onto the bus; enable rcv, THR-empty and modem status
+	// interrupts
+	serial_throttle(0);
 
 	// Clear any preexisting overrun indications and interrupts
 	// Serial port doesn't exist if COM_LSR returns 0xFF
 	serial_exists = (inb(COM1+COM_LSR) != 0xFF);
-	(void) inb(COM1+COM_IIR);
+	// An 8250 or 16450 has no FIFO, and leaves these IIR bits clear
+	serial_fifo = ((inb(COM1+COM_IIR) & COM_IIR_FIFO) == COM_IIR_FIFO ?
+		       COM_FIFOSZ : 1);
 	(void) inb(COM1+COM_RX);
 
+	// Enable serial interrupts
+	if (serial_exists)
+		irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_SERIAL));
 }
 
 
@@ -120,14 +362,92 @@ lpt_putc(int c)
 	outb(0x378+2, 0x08);
 }
 
+static void
+lpt_write(const char *buf, size_t len, int attr)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		lpt_putc(buf[i]);
+}
+
+// A parallel port's data register reads back what was last written to
+// it.  With no port there, reads float to 0xFF, and lpt_putc would wait
+// out its whole timeout on every character.
+static bool
+lpt_probe(void)
+{
+	outb(0x378+0, 0xAA);
+	if (inb(0x378+0) != 0xAA)
+		return 0;
+	outb(0x378+0, 0x55);
+	return inb(0x378+0) == 0x55;
+}
+
+
+
+/***** Debug console output *****/
+// QEMU's and Bochs' debug console takes bytes on port 0xE9 with no
+// status to poll, so a whole run goes out in one rep outsb.  Enable it
+// in QEMU with QEMUEXTRA='-debugcon file:debugcon.log' (or stdio).
+
+#define DEBUGCON	0xE9
+
+static void
+debugcon_write(const char *buf, size_t len, int attr)
+{
+	outsb(DEBUGCON, buf, len);
+}
+
+// Reading the port back returns 0xE9 when the debug console is there
+static bool
+debugcon_probe(void)
+{
+	return inb(DEBUGCON) == DEBUGCON;
+}
+
 
 
 
 /***** Text-mode CGA/VGA display output *****/
 
+// Characters go to crt_shadow, a copy of the screen in ordinary RAM,
+// and reach video memory only in cga_sync(), which copies each screen
+// row changed since the last sync.  Video memory is uncached and slow
+// to touch, and a row copy is one rep movsl.  crt_shadow holds the
+// rows as a ring, with room for CRT_SAVEROWS rows that have scrolled
+// off the top: screen row 0 is shadow row crt_top, so scrolling is
+// just blanking the oldest saved row for the new bottom row.
+// Shift-PgUp and Shift-PgDn show rows from further back (crt_back).
+//
+// In video memory the screen is a CRT_SIZE window starting crt_base
+// characters in.  To scroll, we move the window down a row by changing
+// the 6845's start address, and only the new bottom row needs writing.
+// When the window reaches the end of video memory it goes back to the
+// start, and every row is rewritten from the shadow.  MDA has only
+// room for one screen, so it always rewrites.
+
 static unsigned addr_6845;
-static uint16_t *crt_buf;
-static uint16_t crt_pos;
+static uint16_t *crt_buf;	// start of video memory
+static uint16_t crt_vram;	// size of video memory, in characters
+static uint16_t crt_base;	// screen's offset in video memory
+static uint16_t crt_pos;	// cursor position on the screen
+static uint16_t crt_start;	// crt_base last given to the 6845
+static uint16_t crt_cursor;	// cursor position last given to the 6845
+
+// Rows of scrollback, on top of the screen itself
+#ifndef CRT_SAVEROWS
+#define CRT_SAVEROWS	200
+#endif
+#define CRT_NROWS	(CRT_ROWS + CRT_SAVEROWS)
+
+static uint16_t crt_shadow[CRT_NROWS * CRT_COLS];
+static int crt_top;		// shadow row at the top of the screen
+static int crt_saved;		// rows of scrollback in the shadow
+static int crt_back;		// rows back from the bottom being shown
+static uint32_t crt_dirty;	// screen rows not yet in video memory
+
+struct ConsStat cons_stat;
 
 static void
 cga_init(void)
@@ -142,11 +462,19 @@ cga_init(void)
 	if (*cp != 0xA55A) {
 		cp = (uint16_t*) (KERNBASE + MONO_BUF);
 		addr_6845 = MONO_BASE;
+		crt_vram = MONO_VRAM;
 	} else {
 		*cp = was;
 		addr_6845 = CGA_BASE;
+		crt_vram = CGA_VRAM;
 	}
 
+	/* Show video memory from the start */
+	outb(addr_6845, 12);
+	outb(addr_6845 + 1, 0);
+	outb(addr_6845, 13);
+	outb(addr_6845 + 1, 0);
+
 	/* Extract cursor location */
 	outb(addr_6845, 14);
 	pos = inb(addr_6845 + 1) << 8;
@@ -154,10 +482,71 @@ cga_init(void)
 	pos |= inb(addr_6845 + 1);
 
 	crt_buf = (uint16_t*) cp;
-	crt_pos = pos;
+	crt_base = crt_start = 0;
+	crt_pos = crt_cursor = pos;
+
+	/* Start the shadow with what the BIOS left on the screen */
+	memcpy(crt_shadow, crt_buf, CRT_SIZE * sizeof(uint16_t));
+	crt_top = 0;
+	crt_saved = 0;
+	crt_back = 0;
+	crt_dirty = 0;
+}
+
+// Return the shadow's copy of screen position 'pos', which the caller
+// is about to change
+static uint16_t *
+cga_cell(int pos)
+{
+	int row = crt_top + pos / CRT_COLS;
+
+	if (row >= CRT_NROWS)
+		row -= CRT_NROWS;
+	crt_dirty |= 1 << (pos / CRT_COLS);
+	return &crt_shadow[row * CRT_COLS + pos % CRT_COLS];
 }
 
+// Scroll the screen up a row and blank the new bottom row
+static void
+cga_scroll(void)
+{
+	uint16_t *row;
+	int i;
+
+	// The oldest saved row becomes the new bottom row
+	row = &crt_shadow[((crt_top + CRT_ROWS) % CRT_NROWS) * CRT_COLS];
+	for (i = 0; i < CRT_COLS; i++)
+		row[i] = 0x0700 | ' ';
+	if (++crt_top == CRT_NROWS)
+		crt_top = 0;
+	if (crt_saved < CRT_SAVEROWS)
+		crt_saved++;
+
+	// The rows already in video memory move up with the window
+	if (crt_base + CRT_SIZE + CRT_COLS <= crt_vram) {
+		crt_base += CRT_COLS;
+		crt_dirty = (crt_dirty >> 1) | (1 << (CRT_ROWS - 1));
+	} else {
+		crt_base = 0;
+		crt_dirty = (1 << CRT_ROWS) - 1;
+		cons_stat.cs_scroll_copies++;
+	}
+	cons_stat.cs_scrolls++;
+}
+
+// Show the screen 'n' rows further back in the scrollback,
+// or forward if 'n' is negative
+static void
+cga_scrollback(int n)
+{
+	int back = MAX(0, MIN(crt_back + n, crt_saved));
 
+	if (back == crt_back)
+		return;
+	crt_back = back;
+	crt_dirty = (1 << CRT_ROWS) - 1;
+	cga_sync();
+}
 
 static void
 cga_putc(int c)
@@ -166,11 +555,17 @@ cga_putc(int c)
 	if (!(c & ~0xFF))
 		c |= 0x0700;
 
+	// New output brings the screen back from the scrollback
+	if (crt_back) {
+		crt_back = 0;
+		crt_dirty = (1 << CRT_ROWS) - 1;
+	}
+
 	switch (c & 0xff) {
 	case '\b':
 		if (crt_pos > 0) {
 			crt_pos--;
-			crt_buf[crt_pos] = (c & ~0xff) | ' ';
+			*cga_cell(crt_pos) = (c & ~0xff) | ' ';
 		}
 		break;
 	case '\n':
@@ -180,32 +575,82 @@ cga_putc(int c)
 		crt_pos -= (crt_pos % CRT_COLS);
 		break;
 	case '\t':
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
+		cga_putc((c & ~0xff) | ' ');
+		cga_putc((c & ~0xff) | ' ');
+		cga_putc((c & ~0xff) | ' ');
+		cga_putc((c & ~0xff) | ' ');
+		cga_putc((c & ~0xff) | ' ');
 		break;
 	default:
-		crt_buf[crt_pos++] = c;		/* write the character */
+		*cga_cell(crt_pos++) = c;	/* write the character */
 		break;
 	}
 
-	// What is the purpose of this?
+	// Off the bottom of the screen: scroll
 	if (crt_pos >= CRT_SIZE) {
-		int i;
-
-		memmove(crt_buf, crt_buf + CRT_COLS, (CRT_SIZE - CRT_COLS) * sizeof(uint16_t));
-		for (i = CRT_SIZE - CRT_COLS; i < CRT_SIZE; i++)
-			crt_buf[i] = 0x0700 | ' ';
+		cga_scroll();
 		crt_pos -= CRT_COLS;
 	}
 
-	/* move that little blinky thing */
+	// The screen and cursor follow in cga_sync(), once per cprintf.
+	cons_stat.cs_cursor_moves++;
+}
+
+// Copy the changed rows of the shadow to video memory, give the 6845
+// the screen's start address, and move that little blinky thing to
+// crt_pos.  Video memory and port I/O are slow (and port I/O traps out
+// of a virtual machine), so this is done once per cprintf or read
+// rather than once per character.
+static void
+cga_sync(void)
+{
+	int r, row;
+
+	for (r = 0; crt_dirty; r++) {
+		if (!(crt_dirty & (1 << r)))
+			continue;
+		row = (crt_top - crt_back + r + CRT_NROWS) % CRT_NROWS;
+		// Rows are 160 bytes and 4-byte aligned: memcpy uses
+		// rep movsl
+		memcpy(crt_buf + crt_base + r * CRT_COLS,
+		       crt_shadow + row * CRT_COLS,
+		       CRT_COLS * sizeof(uint16_t));
+		crt_dirty &= ~(1 << r);
+		cons_stat.cs_rows_flushed++;
+	}
+
+	if (crt_start != crt_base) {
+		outb(addr_6845, 12);
+		outb(addr_6845 + 1, crt_base >> 8);
+		outb(addr_6845, 13);
+		outb(addr_6845 + 1, crt_base);
+		crt_start = crt_base;
+		// The cursor address counts from the start of video memory
+		crt_cursor = ~0;
+	}
+	if (crt_cursor == crt_base + crt_pos)
+		return;
 	outb(addr_6845, 14);
-	outb(addr_6845 + 1, crt_pos >> 8);
+	outb(addr_6845 + 1, (crt_base + crt_pos) >> 8);
 	outb(addr_6845, 15);
-	outb(addr_6845 + 1, crt_pos);
+	outb(addr_6845 + 1, crt_base + crt_pos);
+	crt_cursor = crt_base + crt_pos;
+	cons_stat.cs_cursor_syncs++;
+}
+
+static void
+cga_write(const char *buf, size_t len, int attr)
+{
+	uint32_t eflags;
+	size_t i;
+
+	// Keep the keyboard interrupt (which may scroll the screen back)
+	// out of the shadow while we write
+	eflags = read_eflags();
+	asm volatile("cli");
+	for (i = 0; i < len; i++)
+		cga_putc((buf[i] & 0xff) | attr);
+	write_eflags(eflags);
 }
 
 
@@ -355,6 +800,12 @@ kbd_proc_data(void)
 	}
 
 	// Process special keys
+	// Shift-PgUp/PgDn: browse the scrollback
+	if ((shift & SHIFT) && (c == KEY_PGUP || c == KEY_PGDN)) {
+		cga_scrollback(c == KEY_PGUP ? CRT_ROWS / 2 : -CRT_ROWS / 2);
+		return 0;
+	}
+
 	// Ctrl-Alt-Del: reboot
 	if (!(~shift & (CTL | ALT)) && c == KEY_DEL) {
 		cprintf("Rebooting!\n");
@@ -373,6 +824,9 @@ kbd_intr(void)
 static void
 kbd_init(void)
 {
+	// Drain the keyboard buffer so that QEMU generates interrupts.
+	kbd_intr();
+	irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_KBD));
 }
 
 
@@ -382,14 +836,26 @@ kbd_init(void)
 // where we stash characters received from the keyboard or serial port
 // whenever the corresponding interrupt occurs.
 
-#define CONSBUFSIZE 512
+// The buffer is a single-producer, single-consumer ring: only
+// cons_intr() advances wpos and only cons_getc() advances rpos.  Both
+// run freely and wrap modulo 2^32, so wpos - rpos is the number of
+// characters waiting, and CONSBUFSIZE must be a power of 2.  When the
+// buffer is full, cons_intr() leaves further input in the device
+// (the UART's FIFO or the keyboard controller) rather than overwrite
+// characters nobody has read.
 
 static struct {
 	uint8_t buf[CONSBUFSIZE];
-	uint32_t rpos;
-	uint32_t wpos;
+	volatile uint32_t rpos;
+	volatile uint32_t wpos;
 } cons;
 
+static uint32_t
+cons_level(void)
+{
+	return cons.wpos - cons.rpos;
+}
+
 // called by device interrupt routines to feed input characters
 // into the circular console input buffer.
 static void
@@ -397,12 +863,18 @@ cons_intr(int (*proc)(void))
 {
 	int c;
 
-	while ((c = (*proc)()) != -1) {
+	while (1) {
+		if (cons_level() == CONSBUFSIZE) {
+			cons_stat.cs_input_full++;
+			return;
+		}
+		if ((c = (*proc)()) == -1)
+			return;
 		if (c == 0)
 			continue;
-		cons.buf[cons.wpos++] = c;
-		if (cons.wpos == CONSBUFSIZE)
-			cons.wpos = 0;
+		ktrace("cons_intr: 0x%02x, %u waiting", c, cons_level());
+		cons.buf[cons.wpos % CONSBUFSIZE] = c;
+		cons.wpos++;
 	}
 }
 
@@ -410,41 +882,133 @@ cons_intr(int (*proc)(void))
 int
 cons_getc(void)
 {
+	uint32_t eflags;
 	int c;
 
 	// poll for any pending input characters,
 	// so that this function works even when interrupts are disabled
 	// (e.g., when called from the kernel monitor).
+	// The interrupt handlers share the device state.
+	eflags = read_eflags();
+	asm volatile("cli");
 	serial_intr();
 	kbd_intr();
+	write_eflags(eflags);
 
 	// grab the next character from the input buffer.
-	if (cons.rpos != cons.wpos) {
-		c = cons.buf[cons.rpos++];
-		if (cons.rpos == CONSBUFSIZE)
-			cons.rpos = 0;
-		return c;
+	if (cons.rpos == cons.wpos)
+		return 0;
+	c = cons.buf[cons.rpos % CONSBUFSIZE];
+	cons.rpos++;
+
+	// Room again: let the serial port send more
+	if (serial_throttled && cons_level() <= CONS_LOWAT) {
+		eflags = read_eflags();
+		asm volatile("cli");
+		serial_throttle(0);
+		write_eflags(eflags);
+	}
+	return c;
+}
+
+// The output devices.  cons_init() enables each one that its probe
+// finds; the monitor's "cons" command can turn them on and off.
+static bool
+serial_probe(void)
+{
+	return serial_exists;
+}
+
+static bool
+cga_probe(void)
+{
+	return 1;
+}
+
+struct ConsSink cons_sinks[NCONSSINK] = {
+	[SINK_SERIAL]	= { "serial", serial_probe, serial_write },
+	[SINK_LPT]	= { "lpt", lpt_probe, lpt_write },
+	[SINK_CGA]	= { "cga", cga_probe, cga_write },
+	[SINK_DEBUGCON]	= { "debugcon", debugcon_probe, debugcon_write },
+};
+
+// Look up an output device by name
+struct ConsSink *
+cons_sink(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NCONSSINK; i++)
+		if (strcmp(cons_sinks[i].sk_name, name) == 0)
+			return &cons_sinks[i];
+	return NULL;
+}
+
+// output a run of characters, all in color 'attr', to the console.
+// Each enabled device gets the whole run at once, with interrupts as
+// the caller has them: the serial port queues the run and lets its
+// interrupt send it, and the CGA holds off the keyboard itself.
+void
+cons_write(const char *buf, size_t len, int attr)
+{
+	struct ConsSink *sk;
+	uint64_t t;
+
+	for (sk = cons_sinks; sk < cons_sinks + NCONSSINK; sk++) {
+		if (!sk->sk_enabled)
+			continue;
+		t = read_tsc();
+		sk->sk_write(buf, len, attr);
+		sk->sk_cycles += read_tsc() - t;
+		sk->sk_bytes += len;
+		sk->sk_writes++;
 	}
-	return 0;
 }
 
 // output a character to the console
 static void
 cons_putc(int c)
 {
-	serial_putc(c);
-	lpt_putc(c);
-	cga_putc(c);
+	char ch = c;
+
+	cons_write(&ch, 1, c & ~0xff);
+}
+
+// bring the devices up to date with everything written so far
+void
+cons_sync(void)
+{
+	uint32_t eflags;
+
+	eflags = read_eflags();
+	asm volatile("cli");
+	cga_sync();
+	write_eflags(eflags);
+}
+
+// wait until everything written so far has left the machine,
+// for when nothing may be left queued (e.g., a panic)
+void
+cons_flush(void)
+{
+	log_drain();
+	cons_sync();
+	serial_flush();
 }
 
 // initialize the console devices
 void
 cons_init(void)
 {
+	struct ConsSink *sk;
+
 	cga_init();
 	kbd_init();
 	serial_init();
 
+	for (sk = cons_sinks; sk < cons_sinks + NCONSSINK; sk++)
+		sk->sk_enabled = sk->sk_present = sk->sk_probe();
+
 	if (!serial_exists)
 		cprintf("Serial port does not exist!\n");
 }
@@ -455,16 +1019,34 @@ cons_init(void)
 void
 cputchar(int c)
 {
+	// Keep the character in order with what cprintf has logged
+	log_drain();
 	cons_putc(c);
 }
 
 int
 getchar(void)
 {
+	uint32_t eflags;
 	int c;
 
-	while ((c = cons_getc()) == 0)
-		/* do nothing */;
+	eflags = read_eflags();
+	while (1) {
+		// We are idle: let the console catch up with the log
+		log_drain();
+		cons_sync();
+		asm volatile("cli");
+		if ((c = cons_getc()) != 0)
+			break;
+		// Sleep until an interrupt brings input.  sti takes effect
+		// only after the next instruction, so an interrupt that
+		// arrived since cons_getc() still wakes the hlt.  With
+		// interrupts off (e.g., after a panic) nothing would wake
+		// us, so poll instead.
+		if (eflags & FL_IF)
+			asm volatile("sti; hlt");
+	}
+	write_eflags(eflags);
 	return c;
 }
 
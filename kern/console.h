@@ -12,13 +12,76 @@
 #define MONO_BUF	0xB0000
 #define CGA_BASE	0x3D4
 #define CGA_BUF		0xB8000
+#define MONO_VRAM	(4096 / 2)	// characters of video memory
+#define CGA_VRAM	(32768 / 2)
 
 #define CRT_ROWS	25
 #define CRT_COLS	80
 #define CRT_SIZE	(CRT_ROWS * CRT_COLS)
 
+#define CONSBUFSIZE	512			// input buffer; a power of 2
+#define CONS_HIWAT	(CONSBUFSIZE * 3 / 4)	// throttle input above this
+#define CONS_LOWAT	(CONSBUFSIZE / 4)	// resume input below this
+
+// Console statistics, for the monitor's "cons" command
+struct ConsStat {
+	uint32_t cs_cursor_moves;	// characters that moved the CGA cursor
+	uint32_t cs_cursor_syncs;	// times the cursor was sent to the 6845
+	uint32_t cs_scrolls;		// lines scrolled off the screen
+	uint32_t cs_scroll_copies;	// scrolls that rewrote the screen
+	uint32_t cs_rows_flushed;	// rows copied to video memory
+	uint32_t cs_serial_bytes;	// bytes sent to the serial port
+	uint32_t cs_serial_bursts;	// FIFO loads sent to the serial port
+	uint32_t cs_serial_dropped;	// bytes lost to a full transmit ring
+	uint32_t cs_serial_overruns;	// UART receive overruns (bytes lost)
+	uint32_t cs_serial_throttles;	// times we throttled input
+	uint32_t cs_input_full;		// times input waited on a full buffer
+};
+
+// What serial output does when its transmit ring is full
+enum {
+	CONS_FULL_DROP = 0,	// discard the new bytes
+	CONS_FULL_BLOCK,	// wait for room
+	CONS_FULL_OVERWRITE,	// discard the oldest queued bytes
+};
+
+extern int serial_policy;
+extern bool serial_flow;
+
+// Console output devices
+enum {
+	SINK_SERIAL = 0,
+	SINK_LPT,
+	SINK_CGA,
+	SINK_DEBUGCON,
+	NCONSSINK
+};
+
+struct ConsSink {
+	const char *sk_name;
+	bool (*sk_probe)(void);		// is the device there?
+	void (*sk_write)(const char *buf, size_t len, int attr);
+	bool sk_present;		// what sk_probe said at cons_init
+	bool sk_enabled;		// whether cons_write uses it
+	uint32_t sk_writes;		// calls to sk_write
+	uint32_t sk_bytes;		// bytes passed to sk_write
+	uint64_t sk_cycles;		// cycles spent in sk_write
+};
+
+extern struct ConsSink cons_sinks[];
+
+extern struct ConsStat cons_stat;
+
 void cons_init(void);
 int cons_getc(void);
+void cons_write(const char *buf, size_t len, int attr);
+void cons_sync(void);
+void cons_flush(void);
+struct ConsSink *cons_sink(const char *name);
+
+int serial_baud(int baud);
+int serial_getbaud(void);
+void serial_setflow(bool on);
 
 void kbd_intr(void); // irq 1
 void serial_intr(void); // irq 4
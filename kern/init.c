@@ -6,6 +6,10 @@
 
 #include <kern/monitor.h>
 #include <kern/console.h>
+#include <kern/tsc.h>
+#include <kern/boottime.h>
+#include <kern/trap.h>
+#include <kern/picirq.h>
 
 // Test the stack backtrace function (lab 1 only)
 void
@@ -22,19 +26,33 @@ test_backtrace(int x)
 void
 i386_init(void)
 {
-	extern char edata[], end[];
+	boot_stamp_at(BS_ENTRY, entry_tsc);
+	boot_stamp(BS_I386_INIT);
 
-	// Before doing anything else, complete the ELF loading process.
-	// Clear the uninitialized global data (BSS) section of our program.
-	// This ensures that all static/global variables start out zero.
-	memset(edata, 0, end - edata);
+	// Pick memset/memcpy loops for this CPU before anything big is
+	// copied.
+	string_init();
+
+	// The boot loader has already cleared the uninitialized global
+	// data (BSS) section of our program, so all static/global
+	// variables start out zero.
 
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
 	cons_init();
+	boot_stamp(BS_CONS_INIT);
+	tsc_init();
 
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
+	boot_report();
+
+	// Set up interrupts and take them from here on, so that console
+	// output drains, and input arrives, in the background.
+	trap_init();
+	pic_init();
+	asm volatile("sti");
+
 	// Test the stack backtrace function (lab 1 only)
 	test_backtrace(5);
 
@@ -72,6 +90,9 @@ _panic(const char *file, int line, const char *fmt,...)
 	cprintf("\n");
 	va_end(ap);
 
+	// Nothing will drain the console once we stop taking interrupts
+	cons_flush();
+
 dead:
 	/* break into the kernel monitor */
 	while (1)
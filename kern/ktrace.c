@@ -0,0 +1,75 @@
+// Binary trace ring.  ktrace() costs a timestamp and a few stores;
+// the records are turned into text only when the monitor's "trace"
+// command prints them.  "trace raw" prints the records unformatted,
+// with the format string's address, for decoding elsewhere against
+// the kernel's .rodata.
+
+#include <inc/stdio.h>
+#include <inc/stdarg.h>
+#include <inc/x86.h>
+
+#include <kern/ktrace.h>
+#include <kern/tsc.h>
+
+static struct Ktrace ktrace_ring[KTRACE_NREC];
+static uint32_t ktrace_pos;	// next record; runs freely
+
+bool ktrace_enabled = 1;
+
+void
+ktrace_record(const char *fmt, int nargs, ...)
+{
+	struct Ktrace *kt;
+	va_list ap;
+	int i;
+
+	// Claim a record with one atomic add, so that a trace point in
+	// an interrupt handler can't take the same one
+	kt = &ktrace_ring[__sync_fetch_and_add(&ktrace_pos, 1) % KTRACE_NREC];
+	kt->kt_tsc = read_tsc();
+	kt->kt_fmt = fmt;
+	kt->kt_nargs = nargs;
+	va_start(ap, nargs);
+	for (i = 0; i < nargs; i++)
+		kt->kt_args[i] = va_arg(ap, uint32_t);
+	va_end(ap);
+}
+
+void
+ktrace_clear(void)
+{
+	ktrace_pos = 0;
+}
+
+// Print the trace, oldest record first
+void
+ktrace_dump(bool raw)
+{
+	struct Ktrace *kt;
+	uint32_t pos, end;
+	uint64_t t0;
+	int i;
+
+	end = ktrace_pos;
+	pos = end > KTRACE_NREC ? end - KTRACE_NREC : 0;
+	if (pos == end)
+		return;
+	t0 = ktrace_ring[pos % KTRACE_NREC].kt_tsc;
+	for (; pos != end; pos++) {
+		kt = &ktrace_ring[pos % KTRACE_NREC];
+		if (raw) {
+			cprintf("%08x %016llx", kt->kt_fmt, kt->kt_tsc);
+			for (i = 0; i < kt->kt_nargs; i++)
+				cprintf(" %08x", kt->kt_args[i]);
+			cprintf("\n");
+			continue;
+		}
+		// Unused argument words are passed along too, but the
+		// format won't look at them
+		cprintf("%10llu us  ", tsc_to_us(kt->kt_tsc - t0));
+		cprintf(kt->kt_fmt, kt->kt_args[0], kt->kt_args[1],
+			kt->kt_args[2], kt->kt_args[3], kt->kt_args[4],
+			kt->kt_args[5]);
+		cprintf("\n");
+	}
+}
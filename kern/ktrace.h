@@ -0,0 +1,51 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_KTRACE_H
+#define JOS_KERN_KTRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+#define KTRACE_NREC	1024	// records in the trace ring; a power of 2
+#define KTRACE_MAXARGS	6
+
+// One trace record.  Formatting waits until someone reads the trace,
+// so a record holds the format string's address and the raw argument
+// words.  Arguments must therefore be 32-bit values (ints, pointers),
+// and any string arguments must outlive the trace.
+struct Ktrace {
+	const char *kt_fmt;
+	uint64_t kt_tsc;
+	uint32_t kt_nargs;
+	uint32_t kt_args[KTRACE_MAXARGS];
+};
+
+extern bool ktrace_enabled;
+
+// ktrace(fmt, ...) records fmt and up to KTRACE_MAXARGS arguments.
+// Passing more is a compile-time error.
+#define ktrace(fmt, ...)						\
+	do {								\
+		_Static_assert(KTRACE_NARGS(__VA_ARGS__) <=		\
+			       KTRACE_MAXARGS,				\
+			       "too many arguments to ktrace");		\
+		if (ktrace_enabled)					\
+			ktrace_record(fmt, KTRACE_NARGS(__VA_ARGS__),	\
+				      ##__VA_ARGS__);			\
+	} while (0)
+
+// Counts up to 12 arguments, so that calls with a few too many are
+// caught above.  (With more than 12, the "count" isn't a constant,
+// and that fails to compile too.)
+#define KTRACE_NARGS(...) \
+	KTRACE_NARGS_(0, ##__VA_ARGS__, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define KTRACE_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, \
+		      _12, n, ...) n
+
+void ktrace_record(const char *fmt, int nargs, ...);
+void ktrace_clear(void);
+void ktrace_dump(bool raw);
+
+#endif	// !JOS_KERN_KTRACE_H
@@ -0,0 +1,111 @@
+// The kernel log: a ring holding the last LOGSIZE characters that
+// cprintf printed, each with its color.  cprintf only appends to the
+// ring; the console devices catch up in log_drain(), which runs when
+// the kernel goes idle waiting for input, when the ring fills, and on
+// every write while interrupts are off (early in boot, or after a
+// panic), when nothing else might ever drain it.  Interrupts are off
+// only while the ring itself is touched, never while the console
+// devices run.
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+
+#include <kern/console.h>
+#include <kern/log.h>
+
+static struct {
+	uint16_t buf[LOGSIZE];	// characters, with their color
+	uint32_t wpos;		// next character to write
+	uint32_t cpos;		// next character for the console
+} klog;
+
+bool log_async = 1;
+
+// Copy the run of one color that starts at cell *pos, stopping at
+// 'end' or after 'size' cells, out of the ring into 'run'.  Advances
+// *pos past it and returns its length.  Interrupts must be off.
+static int
+log_take(uint32_t *pos, uint32_t end, char *run, int size, int *attr)
+{
+	int n;
+
+	*attr = klog.buf[*pos % LOGSIZE] & ~0xff;
+	for (n = 0; *pos != end && n < size &&
+		     (klog.buf[*pos % LOGSIZE] & ~0xff) == *attr; n++)
+		run[n] = klog.buf[(*pos)++ % LOGSIZE];
+	return n;
+}
+
+// Append 'len' characters in color 'attr' to the log
+void
+log_write(const char *buf, size_t len, int attr)
+{
+	uint32_t eflags;
+	size_t i = 0;
+
+	eflags = read_eflags();
+	while (1) {
+		asm volatile("cli");
+		for (; i < len && klog.wpos - klog.cpos < LOGSIZE; i++)
+			klog.buf[klog.wpos++ % LOGSIZE] = (buf[i] & 0xff) | attr;
+		write_eflags(eflags);
+		if (i == len)
+			break;
+		// Don't overwrite what the console hasn't seen
+		log_drain();
+	}
+	if (!log_async || !(eflags & FL_IF))
+		log_drain();
+}
+
+// Send everything logged so far to the console.  Each run is taken
+// out of the ring with interrupts off, but goes to the console with
+// them as the caller had them, so the serial port can queue it rather
+// than send it then and there.  A drain in an interrupt handler may
+// send its runs ahead of one that the interrupted drain has taken.
+void
+log_drain(void)
+{
+	char run[128];
+	uint32_t eflags, pos;
+	int attr, n;
+
+	eflags = read_eflags();
+	while (klog.cpos != klog.wpos) {
+		asm volatile("cli");
+		pos = klog.cpos;
+		n = log_take(&pos, klog.wpos, run, sizeof(run), &attr);
+		klog.cpos = pos;
+		write_eflags(eflags);
+		if (n > 0)
+			cons_write(run, n, attr);
+	}
+}
+
+// Print the whole log on the console again, for the monitor's dmesg
+void
+log_replay(void)
+{
+	char run[128];
+	uint32_t eflags, pos, end;
+	int attr, n;
+
+	log_drain();
+	eflags = read_eflags();
+	asm volatile("cli");
+	end = klog.wpos;
+	pos = end > LOGSIZE ? end - LOGSIZE : 0;
+	write_eflags(eflags);
+
+	while ((int32_t) (end - pos) > 0) {
+		asm volatile("cli");
+		// Skip anything overwritten since we started
+		if (klog.wpos - pos > LOGSIZE)
+			pos = klog.wpos - LOGSIZE;
+		n = (int32_t) (end - pos) > 0 ?
+			log_take(&pos, end, run, sizeof(run), &attr) : 0;
+		write_eflags(eflags);
+		if (n > 0)
+			cons_write(run, n, attr);
+	}
+}
@@ -0,0 +1,20 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_LOG_H
+#define JOS_KERN_LOG_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+#define LOGSIZE		8192	// characters of kernel log; a power of 2
+
+// If set (the default), log_write leaves the console to catch up later.
+extern bool log_async;
+
+void log_write(const char *buf, size_t len, int attr);
+void log_drain(void);
+void log_replay(void);
+
+#endif	// !JOS_KERN_LOG_H
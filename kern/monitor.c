@@ -11,6 +11,10 @@
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/boottime.h>
+#include <kern/tsc.h>
+#include <kern/log.h>
+#include <kern/ktrace.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -26,6 +30,13 @@ static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
 	{ "backtrace", "Display backtrace information of stack", mon_backtrace },
+	{ "boottime", "Display the boot timeline", mon_boottime },
+	{ "tlbstat", "Display what an address space switch costs the TLB", mon_tlbstat },
+	{ "cons", "Display or configure the console", mon_cons },
+	{ "dmesg", "Display the kernel log", mon_dmesg },
+	{ "trace", "Display or control the trace buffer", mon_trace },
+	{ "fmtbench", "Time number formatting", mon_fmtbench },
+	{ "dump", "Display memory in hex", mon_dump },
 };
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -63,14 +74,14 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 	cprintf("Stack backtrace:\n");
 	uint32_t *ebp = (uint32_t *)read_ebp();
 	while (ebp) {
-		cprintf("  ebp %08x  eip %08x  args", ebp, ebp[1]);
+		CPRINTF_CACHED("  ebp %08x  eip %08x  args", ebp, ebp[1]);
 		for (int i = 2; i < 7; ++i) {
-			cprintf(" %08x", ebp[i]);
+			CPRINTF_CACHED(" %08x", ebp[i]);
 		}
 		cprintf("\n");
 		struct Eipdebuginfo info;
 		int success = debuginfo_eip(ebp[1], &info);
-		cprintf("         %s:%d: %.*s+%d\n", info.eip_file, info.eip_line, info.eip_fn_namelen, info.eip_fn_name, ebp[1] - info.eip_fn_addr);
+		CPRINTF_CACHED("         %s:%d: %.*s+%d\n", info.eip_file, info.eip_line, info.eip_fn_namelen, info.eip_fn_name, ebp[1] - info.eip_fn_addr);
 		ebp = (uint32_t *) (*ebp);
 	}
 
@@ -78,6 +89,297 @@ mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 }
 
 
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf)
+{
+	struct Bootinfo *bi;
+	struct Bootstamp *bs;
+	uint64_t t0, prev;
+	int i;
+
+	if (!(bi = bootinfo())) {
+		cprintf("No boot timeline: not booted by the JOS boot loader\n");
+		return 0;
+	}
+
+	cprintf("Boot timeline (TSC cycles since bootmain, delta, us):\n");
+	t0 = prev = bi->bi_stamp[0].bs_tsc;
+	for (i = 0; i < bi->bi_nstamp; i++) {
+		bs = &bi->bi_stamp[i];
+		cprintf("  %10s", boot_stamp_name(bs->bs_what));
+		if (bs->bs_what == BS_SEGMENT)
+			cprintf(" %d", bs->bs_arg);
+		else
+			cprintf("  ");
+		cprintf(" %12llu %12llu %8llu\n", bs->bs_tsc - t0,
+			bs->bs_tsc - prev, tsc_to_us(bs->bs_tsc - t0));
+		prev = bs->bs_tsc;
+	}
+	return 0;
+}
+
+// Count the present mappings in 'pgdir' and how many of them are global.
+static void
+count_mappings(pde_t *pgdir, int *total, int *global)
+{
+	pte_t *pt;
+	int i, j;
+
+	*total = *global = 0;
+	for (i = 0; i < NPDENTRIES; i++) {
+		if (!(pgdir[i] & PTE_P))
+			continue;
+		if (pgdir[i] & PTE_PS) {
+			++*total;
+			*global += !!(pgdir[i] & PTE_G);
+			continue;
+		}
+		pt = (pte_t *) (KERNBASE + PTE_ADDR(pgdir[i]));
+		for (j = 0; j < NPTENTRIES; j++)
+			if (pt[j] & PTE_P) {
+				++*total;
+				*global += !!(pt[j] & PTE_G);
+			}
+	}
+}
+
+#define NSWITCH		100
+
+// Average cycles for a CR3 reload followed by touching every page of
+// the kernel image, with global pages on or off.
+static uint64_t
+time_switch(bool pge)
+{
+	extern char entry[], end[];
+	uint32_t cr4;
+	uint64_t t;
+	char *va;
+	int i;
+
+	cr4 = rcr4();
+	lcr4(pge ? cr4 | CR4_PGE : cr4 & ~CR4_PGE);
+	t = read_tsc();
+	for (i = 0; i < NSWITCH; i++) {
+		lcr3(rcr3());
+		for (va = (char *) ROUNDDOWN((uint32_t) entry, PGSIZE); va < end;
+		     va += PGSIZE)
+			(void) *(volatile char *) va;
+	}
+	t = read_tsc() - t;
+	lcr4(cr4);
+	return t / NSWITCH;
+}
+
+int
+mon_tlbstat(int argc, char **argv, struct Trapframe *tf)
+{
+	int total, global;
+
+	count_mappings((pde_t *) (KERNBASE + rcr3()), &total, &global);
+	cprintf("CR4.PGE %s; %d mappings, %d global\n",
+		rcr4() & CR4_PGE ? "on" : "off", total, global);
+	cprintf("A CR3 reload invalidates %d TLB entries\n",
+		rcr4() & CR4_PGE ? total - global : total);
+	// entry.S leaves CR4.PGE off on a CPU without global pages
+	if (rcr4() & CR4_PGE)
+		cprintf("CR3 reload + kernel working set: %llu cycles with "
+			"global pages, %llu without\n",
+			time_switch(true), time_switch(false));
+	else
+		cprintf("CR3 reload + kernel working set: %llu cycles\n",
+			time_switch(false));
+	cprintf("(The kernel is mapped with 4MB pages, so this says little "
+		"about\nwhat a CR3 reload costs a kernel on 4KB pages.)\n");
+	return 0;
+}
+
+static const char * const full_policy[] = {
+	[CONS_FULL_DROP]	= "drop",
+	[CONS_FULL_BLOCK]	= "block",
+	[CONS_FULL_OVERWRITE]	= "overwrite",
+};
+
+int
+mon_cons(int argc, char **argv, struct Trapframe *tf)
+{
+	struct ConsStat cs = cons_stat;
+	struct ConsSink *sk;
+	int i, r;
+
+	if (argc == 3 && strcmp(argv[1], "baud") == 0) {
+		if ((r = serial_baud(strtol(argv[2], 0, 0))) < 0)
+			cprintf("cons: %e\n", r);
+		return 0;
+	}
+	if (argc == 3 && strcmp(argv[1], "full") == 0) {
+		for (i = 0; i < ARRAY_SIZE(full_policy); i++)
+			if (strcmp(argv[2], full_policy[i]) == 0) {
+				serial_policy = i;
+				return 0;
+			}
+	}
+	if (argc == 3 && (strcmp(argv[1], "on") == 0 ||
+			  strcmp(argv[1], "off") == 0 ||
+			  strcmp(argv[1], "only") == 0)) {
+		if (!(sk = cons_sink(argv[2])))
+			cprintf("cons: no device '%s'\n", argv[2]);
+		else if (strcmp(argv[1], "off") != 0 && !sk->sk_present)
+			cprintf("cons: %s is not present\n", sk->sk_name);
+		else if (strcmp(argv[1], "only") == 0)
+			for (i = 0; i < NCONSSINK; i++)
+				cons_sinks[i].sk_enabled = (&cons_sinks[i] == sk);
+		else
+			sk->sk_enabled = (argv[1][1] == 'n');
+		return 0;
+	}
+	if (argc == 3 && strcmp(argv[1], "flow") == 0 &&
+	    (strcmp(argv[2], "on") == 0 || strcmp(argv[2], "off") == 0)) {
+		serial_setflow(argv[2][1] == 'n');
+		return 0;
+	}
+	if (argc != 1) {
+		cprintf("Usage: cons [on|off|only DEVICE | baud N | "
+			"full drop|block|overwrite | flow on|off]\n");
+		return 0;
+	}
+
+	cprintf("device   state    writes    bytes  cycles/byte\n");
+	for (sk = cons_sinks; sk < cons_sinks + NCONSSINK; sk++)
+		cprintf("%-8s %-7s %7u %8u %12llu\n", sk->sk_name,
+			!sk->sk_present ? "absent" : sk->sk_enabled ? "on" : "off",
+			sk->sk_writes, sk->sk_bytes,
+			sk->sk_bytes ? sk->sk_cycles / sk->sk_bytes : 0);
+
+	cprintf("Input: buffer full %u times, %u UART overruns; "
+		"RTS/CTS %s, throttled %u times\n", cs.cs_input_full,
+		cs.cs_serial_overruns, serial_flow ? "on" : "off",
+		cs.cs_serial_throttles);
+	cprintf("CGA cursor: %u moves, %u sent to the 6845, "
+		"%u port writes saved\n", cs.cs_cursor_moves,
+		cs.cs_cursor_syncs, 4 * (cs.cs_cursor_moves - cs.cs_cursor_syncs));
+	cprintf("CGA scrolling: %u lines, %u by rewriting the screen\n",
+		cs.cs_scrolls, cs.cs_scroll_copies);
+	cprintf("CGA shadow: %u rows copied to video memory\n",
+		cs.cs_rows_flushed);
+	cprintf("Serial: %d baud, %u bytes in %u bursts, %u dropped "
+		"(%s when full)\n", serial_getbaud(), cs.cs_serial_bytes,
+		cs.cs_serial_bursts, cs.cs_serial_dropped,
+		full_policy[serial_policy]);
+	return 0;
+}
+
+int
+mon_dmesg(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 2 && strcmp(argv[1], "sync") == 0)
+		log_async = 0;
+	else if (argc == 2 && strcmp(argv[1], "async") == 0)
+		log_async = 1;
+	else if (argc == 1)
+		log_replay();
+	else
+		cprintf("Usage: dmesg [sync|async]\n");
+	return 0;
+}
+
+int
+mon_trace(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 2 && strcmp(argv[1], "dump") == 0)
+		ktrace_dump(0);
+	else if (argc == 2 && strcmp(argv[1], "raw") == 0)
+		ktrace_dump(1);
+	else if (argc == 2 && strcmp(argv[1], "clear") == 0)
+		ktrace_clear();
+	else if (argc == 2 && strcmp(argv[1], "on") == 0)
+		ktrace_enabled = 1;
+	else if (argc == 2 && strcmp(argv[1], "off") == 0)
+		ktrace_enabled = 0;
+	else
+		cprintf("Usage: trace dump|raw|clear|on|off\n");
+	return 0;
+}
+
+#define NFMTBENCH	1000
+
+// Average cycles for snprintf to format 'val' with 'fmt', which keeps
+// the console out of the measurement
+static uint64_t
+time_format(const char *fmt, uint32_t val)
+{
+	char buf[32];
+	uint64_t t;
+	int i;
+
+	t = read_tsc();
+	for (i = 0; i < NFMTBENCH; i++)
+		snprintf(buf, sizeof(buf), fmt, val);
+	return (read_tsc() - t) / NFMTBENCH;
+}
+
+int
+mon_fmtbench(int argc, char **argv, struct Trapframe *tf)
+{
+	static const char * const fmts[] = { "%d", "%x", "%08x" };
+	static const uint32_t vals[] = { 7, 0xf0100000, 2147483647 };
+	int i, j;
+
+	cprintf("format %12s %12s %12s  (cycles per snprintf)\n",
+		"7", "0xf0100000", "2147483647");
+	for (i = 0; i < ARRAY_SIZE(fmts); i++) {
+		cprintf("%-6s", fmts[i]);
+		for (j = 0; j < ARRAY_SIZE(vals); j++)
+			cprintf(" %12llu", time_format(fmts[i], vals[j]));
+		cprintf("\n");
+	}
+	return 0;
+}
+
+// Is 'va' mapped in 'pgdir'?
+static bool
+va_mapped(pde_t *pgdir, uintptr_t va)
+{
+	pde_t pde = pgdir[PDX(va)];
+	pte_t *pt;
+
+	if (!(pde & PTE_P))
+		return false;
+	if (pde & PTE_PS)
+		return true;
+	pt = (pte_t *) (KERNBASE + PTE_ADDR(pde));
+	return pt[PTX(va)] & PTE_P;
+}
+
+#define DUMPLINE	16	// bytes per line of dump
+
+int
+mon_dump(int argc, char **argv, struct Trapframe *tf)
+{
+	pde_t *pgdir = (pde_t *) (KERNBASE + rcr3());
+	uintptr_t va;
+	int len, n;
+
+	if (argc != 2 && argc != 3) {
+		cprintf("Usage: dump ADDR [LEN]\n");
+		return 0;
+	}
+	va = strtol(argv[1], 0, 0);
+	len = (argc == 3 ? strtol(argv[2], 0, 0) : 4 * DUMPLINE);
+	// Stop at 4GB rather than wrap around to page 0
+	if (len > 0 && (uint32_t) len - 1 > ~va)
+		len = ~va + 1;
+	for (; len > 0; va += n, len -= n) {
+		n = MIN(len, DUMPLINE);
+		if (!va_mapped(pgdir, va) || !va_mapped(pgdir, va + n - 1)) {
+			cprintf("dump: %08x is not mapped\n",
+				va_mapped(pgdir, va) ? ROUNDUP(va, PGSIZE) : va);
+			break;
+		}
+		CPRINTF_CACHED("%08x: %*ph\n", va, n, va);
+	}
+	return 0;
+}
+
 
 /***** Kernel monitor command interpreter *****/
 
@@ -126,6 +428,7 @@ runcmd(char *buf, struct Trapframe *tf)
 void
 monitor(struct Trapframe *tf)
 {
+	static bool prompted;
 	char *buf;
 
 	cprintf("Welcome to the JOS kernel monitor!\n");
@@ -138,8 +441,16 @@ monitor(struct Trapframe *tf)
 	cprintf("\n%C", LIGHT_GRAY);
 	cprintf("Type 'help' for a list of commands.\n");
 
+	if (!prompted) {
+		boot_stamp(BS_MONITOR);
+		prompted = true;
+	}
 
 	while (1) {
+		// Get everything printed so far onto the wire before we
+		// wait for input: cprintf leaves it in the log, and the
+		// serial port in its transmit ring
+		cons_flush();
 		buf = readline("K> ");
 		if (buf != NULL)
 			if (runcmd(buf, tf) < 0)
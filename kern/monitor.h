@@ -15,5 +15,12 @@ void monitor(struct Trapframe *tf);
 int mon_help(int argc, char **argv, struct Trapframe *tf);
 int mon_kerninfo(int argc, char **argv, struct Trapframe *tf);
 int mon_backtrace(int argc, char **argv, struct Trapframe *tf);
+int mon_boottime(int argc, char **argv, struct Trapframe *tf);
+int mon_tlbstat(int argc, char **argv, struct Trapframe *tf);
+int mon_cons(int argc, char **argv, struct Trapframe *tf);
+int mon_dmesg(int argc, char **argv, struct Trapframe *tf);
+int mon_trace(int argc, char **argv, struct Trapframe *tf);
+int mon_fmtbench(int argc, char **argv, struct Trapframe *tf);
+int mon_dump(int argc, char **argv, struct Trapframe *tf);
 
 #endif	// !JOS_KERN_MONITOR_H
@@ -1,28 +1,97 @@
 // Simple implementation of cprintf console output for the kernel,
-// based on printfmt() and the kernel console's cputchar().
+// based on printfmt() and the kernel log, which feeds the console.
 
 #include <inc/types.h>
 #include <inc/stdio.h>
 #include <inc/stdarg.h>
+#include <inc/string.h>
 #include <inc/tcolor.h>
 
+#include <kern/console.h>
+#include <kern/log.h>
+
 unsigned int textcolor = 0x0700;
 
+// Collect the characters of one cprintf() so that each run of one color
+// reaches the kernel log as a single log_write().
+struct printbuf {
+	int idx;	// current buffer index
+	int cnt;	// total bytes printed so far
+	int attr;	// color of the characters in buf
+	char buf[256];
+};
+
+static void
+flush(struct printbuf *b)
+{
+	if (b->idx > 0)
+		log_write(b->buf, b->idx, b->attr);
+	b->idx = 0;
+}
+
+static void
+putch(int ch, struct printbuf *b)
+{
+	if (b->attr != textcolor) {
+		flush(b);
+		b->attr = textcolor;
+	}
+	b->buf[b->idx++] = ch;
+	if (b->idx == sizeof(b->buf))
+		flush(b);
+	b->cnt++;
+}
+
 static void
-putch(int ch, int *cnt)
+putbuf(const char *s, size_t len, struct printbuf *b)
 {
-	ch |= textcolor;
-	cputchar(ch);
-	*cnt++;
+	size_t n;
+
+	if (b->attr != textcolor) {
+		flush(b);
+		b->attr = textcolor;
+	}
+	b->cnt += len;
+	// Too big to be worth copying: send it on as it is
+	if (len >= sizeof(b->buf)) {
+		flush(b);
+		log_write(s, len, b->attr);
+		return;
+	}
+	while (len > 0) {
+		n = MIN(len, sizeof(b->buf) - b->idx);
+		memcpy(b->buf + b->idx, s, n);
+		b->idx += n;
+		s += n;
+		len -= n;
+		if (b->idx == sizeof(b->buf))
+			flush(b);
+	}
 }
 
 int
 vcprintf(const char *fmt, va_list ap)
 {
-	int cnt = 0;
+	return vcprintf_cached(NULL, fmt, ap);
+}
 
-	vprintfmt((void*)putch, &cnt, fmt, ap);
-	return cnt;
+// vcprintf, running fmt from the ops compiled into fc if fc isn't NULL
+int
+vcprintf_cached(struct Fmtcache *fc, const char *fmt, va_list ap)
+{
+	struct printbuf b;
+
+	b.idx = 0;
+	b.cnt = 0;
+	b.attr = textcolor;
+	if (fc)
+		vprintfmt_cached((void*)putch, (void*)putbuf, &b, fc, fmt, ap);
+	else
+		vprintfmt_bulk((void*)putch, (void*)putbuf, &b, fmt, ap);
+	flush(&b);
+	cons_sync();
+
+	return b.cnt;
 }
 
 int
@@ -38,3 +107,15 @@ cprintf(const char *fmt, ...)
 	return cnt;
 }
 
+int
+cprintf_cached(struct Fmtcache *fc, const char *fmt, ...)
+{
+	va_list ap;
+	int cnt;
+
+	va_start(ap, fmt);
+	cnt = vcprintf_cached(fc, fmt, ap);
+	va_end(ap);
+
+	return cnt;
+}
@@ -0,0 +1,169 @@
+#include <inc/mmu.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+#include <inc/assert.h>
+
+#include <kern/trap.h>
+#include <kern/console.h>
+#include <kern/monitor.h>
+#include <kern/picirq.h>
+
+// Global descriptor table: the kernel's flat code and data segments.
+// The boot loader's GDT lives in low memory, which the kernel maps
+// only for the first few instructions of entry.S.
+struct Segdesc gdt[] =
+{
+	// 0x0 - unused (always faults -- for trapping NULL far pointers)
+	SEG_NULL,
+
+	// 0x8 - kernel code segment
+	[GD_KT >> 3] = SEG(STA_X | STA_R, 0x0, 0xffffffff, 0),
+
+	// 0x10 - kernel data segment
+	[GD_KD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 0),
+};
+
+struct Pseudodesc gdt_pd = {
+	sizeof(gdt) - 1, (unsigned long) gdt
+};
+
+/* Interrupt descriptor table.  (Must be built at run time because
+ * shifted function addresses can't be represented in relocation records.)
+ */
+struct Gatedesc idt[256] = { { 0 } };
+struct Pseudodesc idt_pd = {
+	sizeof(idt) - 1, (uint32_t) idt
+};
+
+// Trap numbers and entry points, from trapentry.S, ending with a null
+// entry point
+extern struct {
+	uint32_t trapno;
+	void (*handler)(void);
+} trap_handlers[];
+
+
+static const char *trapname(int trapno)
+{
+	static const char * const excnames[] = {
+		"Divide error",
+		"Debug",
+		"Non-Maskable Interrupt",
+		"Breakpoint",
+		"Overflow",
+		"BOUND Range Exceeded",
+		"Invalid Opcode",
+		"Device Not Available",
+		"Double Fault",
+		"Coprocessor Segment Overrun",
+		"Invalid TSS",
+		"Segment Not Present",
+		"Stack Fault",
+		"General Protection",
+		"Page Fault",
+		"(unknown trap)",
+		"x87 FPU Floating-Point Error",
+		"Alignment Check",
+		"Machine-Check",
+		"SIMD Floating-Point Exception"
+	};
+
+	if (trapno < ARRAY_SIZE(excnames))
+		return excnames[trapno];
+	if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 16)
+		return "Hardware Interrupt";
+	return "(unknown trap)";
+}
+
+
+void
+trap_init(void)
+{
+	int i;
+
+	for (i = 0; trap_handlers[i].handler; i++)
+		SETGATE(idt[trap_handlers[i].trapno], 0, GD_KT,
+			trap_handlers[i].handler, 0);
+
+	// Per-CPU setup
+	trap_init_percpu();
+}
+
+// Load the kernel's GDT and IDT.
+void
+trap_init_percpu(void)
+{
+	lgdt(&gdt_pd);
+	// Reload the segment registers from the new GDT.
+	asm volatile("movw %%ax,%%gs" : : "a" (GD_KD));
+	asm volatile("movw %%ax,%%fs" : : "a" (GD_KD));
+	asm volatile("movw %%ax,%%es" : : "a" (GD_KD));
+	asm volatile("movw %%ax,%%ds" : : "a" (GD_KD));
+	asm volatile("movw %%ax,%%ss" : : "a" (GD_KD));
+	// Reload cs with a long jump
+	asm volatile("ljmp %0,$1f\n 1:\n" : : "i" (GD_KT));
+
+	lidt(&idt_pd);
+}
+
+void
+print_trapframe(struct Trapframe *tf)
+{
+	cprintf("TRAP frame at %p\n", tf);
+	print_regs(&tf->tf_regs);
+	cprintf("  es   0x----%04x\n", tf->tf_es);
+	cprintf("  ds   0x----%04x\n", tf->tf_ds);
+	cprintf("  trap 0x%08x %s\n", tf->tf_trapno, trapname(tf->tf_trapno));
+	if (tf->tf_trapno == T_PGFLT)
+		cprintf("  cr2  0x%08x\n", rcr2());
+	cprintf("  err  0x%08x\n", tf->tf_err);
+	cprintf("  eip  0x%08x\n", tf->tf_eip);
+	cprintf("  cs   0x----%04x\n", tf->tf_cs);
+	cprintf("  flag 0x%08x\n", tf->tf_eflags);
+}
+
+void
+print_regs(struct PushRegs *regs)
+{
+	cprintf("  edi  0x%08x\n", regs->reg_edi);
+	cprintf("  esi  0x%08x\n", regs->reg_esi);
+	cprintf("  ebp  0x%08x\n", regs->reg_ebp);
+	cprintf("  oesp 0x%08x\n", regs->reg_oesp);
+	cprintf("  ebx  0x%08x\n", regs->reg_ebx);
+	cprintf("  edx  0x%08x\n", regs->reg_edx);
+	cprintf("  ecx  0x%08x\n", regs->reg_ecx);
+	cprintf("  eax  0x%08x\n", regs->reg_eax);
+}
+
+static void
+trap_dispatch(struct Trapframe *tf)
+{
+	switch (tf->tf_trapno) {
+	case IRQ_OFFSET + IRQ_KBD:
+		kbd_intr();
+		return;
+
+	case IRQ_OFFSET + IRQ_SERIAL:
+		serial_intr();
+		return;
+
+	case IRQ_OFFSET + IRQ_SPURIOUS:
+		// The 8259A raises IRQ 7 when an interrupt goes away
+		// before it can be acknowledged; there is nothing to do.
+		return;
+	}
+
+	// Unexpected trap: the kernel is broken.
+	print_trapframe(tf);
+	panic("unhandled trap in kernel");
+}
+
+void
+trap(struct Trapframe *tf)
+{
+	// The interrupted code may have set DF, and some versions
+	// of GCC rely on DF being clear
+	asm volatile("cld" ::: "cc");
+
+	trap_dispatch(tf);
+}
@@ -0,0 +1,45 @@
+// Calibration of the CPU's time stamp counter against the 8254 PIT,
+// so that cycle counts can be reported as time.
+
+#include <inc/x86.h>
+
+#include <kern/tsc.h>
+
+#define PIT_HZ		1193182	// PIT input clock
+#define PIT_CH2		0x42	// channel 2 counter
+#define PIT_MODE	0x43	// mode/command register
+#define PIT_PORTB	0x61	// bit 0 gates channel 2, bit 5 is its output
+
+#define CALIBRATE_HZ	100	// calibrate over 1/100 s
+
+uint64_t tsc_hz;
+
+void
+tsc_init(void)
+{
+	uint32_t latch = PIT_HZ / CALIBRATE_HZ;
+	uint64_t t0, t1;
+
+	// Gate channel 2 on, with the speaker off, and start a one-shot
+	// count (mode 0).  Its output goes high when the count runs out.
+	outb(PIT_PORTB, (inb(PIT_PORTB) & ~0x02) | 0x01);
+	outb(PIT_MODE, 0xB0);		// channel 2, lobyte/hibyte, mode 0
+	outb(PIT_CH2, latch & 0xFF);
+	outb(PIT_CH2, latch >> 8);
+
+	t0 = read_tsc();
+	while (!(inb(PIT_PORTB) & 0x20))
+		/* do nothing */;
+	t1 = read_tsc();
+
+	tsc_hz = (t1 - t0) * CALIBRATE_HZ;
+}
+
+// Convert a cycle count to microseconds.
+uint64_t
+tsc_to_us(uint64_t cycles)
+{
+	if (tsc_hz == 0)
+		return 0;
+	return cycles * 1000000 / tsc_hz;
+}
@@ -17,6 +17,10 @@
  * and prints a string describing the error.
  * The integer may be positive or negative,
  * so that -E_NO_MEM and E_NO_MEM are equivalent.
+ *
+ * The special format %*ph takes a length and a pointer and prints that
+ * many bytes from the pointer in hex, separated by spaces; %*phN leaves
+ * out the spaces.  A length written into the format (%16ph) also works.
  */
 
 static const char * const error_string[MAXERROR] =
@@ -29,25 +33,119 @@ static const char * const error_string[MAXERROR] =
 	[E_FAULT]	= "segmentation fault",
 };
 
+// Print 'len' characters of 's': in one call if there's a putbuf,
+// otherwise one putch at a time.
+static void
+putrun(void (*putch)(int, void*), void (*putbuf)(const char*, size_t, void*),
+       void *putdat, const char *s, size_t len)
+{
+	if (putbuf) {
+		if (len > 0)
+			putbuf(s, len, putdat);
+		return;
+	}
+	while (len-- > 0)
+		putch(*(unsigned char *) s++, putdat);
+}
+
+static const char digits[] = "0123456789abcdef";
+
+// "00" through "99", for converting decimal two digits at a time
+static const char digitpairs[] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
 /*
- * Print a number (base <= 16) in reverse order,
+ * Print a number (base <= 16), padded on the left with padc to width,
  * using specified putch function and associated pointer putdat.
+ * The digits are converted right to left into a buffer.  Bases 8 and
+ * 16 need only shifts and masks; other bases divide in 32 bits once
+ * the number fits, and base 10 produces two digits per divide.  Only
+ * numbers above 2^32 in other bases need a 64-bit divide per digit.
  */
 static void
-printnum(void (*putch)(int, void*), void *putdat,
-	 unsigned long long num, unsigned base, int width, int padc)
+printnum(void (*putch)(int, void*), void (*putbuf)(const char*, size_t, void*),
+	 void *putdat, unsigned long long num, unsigned base, int width,
+	 int padc)
 {
-	// first recursively print all preceding (more significant) digits
-	if (num >= base) {
-		printnum(putch, putdat, num / base, base, width - 1, padc);
+	char buf[22];		// 2^64 - 1 in octal
+	char *p = buf + sizeof(buf);
+	unsigned shift, n, q;
+
+	if (base == 16 || base == 8) {
+		shift = (base == 16 ? 4 : 3);
+		do {
+			*--p = digits[num & (base - 1)];
+			num >>= shift;
+		} while (num);
 	} else {
-		// print any needed pad characters before first digit
-		while (--width > 0)
-			putch(padc, putdat);
+		while (num > 0xFFFFFFFFULL) {
+			*--p = digits[num % base];
+			num /= base;
+		}
+		n = num;
+		if (base == 10)
+			for (; n >= 100; n = q) {
+				q = n / 100;
+				p -= 2;
+				p[0] = digitpairs[2 * (n - 100 * q)];
+				p[1] = digitpairs[2 * (n - 100 * q) + 1];
+			}
+		do {
+			*--p = digits[n % base];
+			n /= base;
+		} while (n);
 	}
 
-	// then print this (the least significant) digit
-	putch("0123456789abcdef"[num % base], putdat);
+	// print any needed pad characters before first digit
+	for (width -= buf + sizeof(buf) - p; width > 0; width--)
+		putch(padc, putdat);
+	putrun(putch, putbuf, putdat, p, buf + sizeof(buf) - p);
+}
+
+// Print 'len' bytes from 'p' in hex, with 'sep' between bytes if it
+// isn't 0.  Whole 32-bit words are loaded and encoded at a time, one
+// digits[] lookup per nibble, and each bufferful goes out as one run.
+static void
+printhex(void (*putch)(int, void*), void (*putbuf)(const char*, size_t, void*),
+	 void *putdat, const unsigned char *p, int len, int sep)
+{
+	char buf[12 * 12];	// 12 words, at 12 characters each
+	char *q = buf;
+	uint32_t w;
+	int n;
+
+	if (p == NULL) {
+		putrun(putch, putbuf, putdat, "(null)", 6);
+		return;
+	}
+	while (len > 0) {
+		if (len >= 4) {
+			w = *(const uint32_t *) p;
+			n = 4;
+		} else
+			for (w = 0, n = 0; n < len; n++)
+				w |= (uint32_t) p[n] << (8 * n);
+		p += n;
+		len -= n;
+		// The first byte in memory is the low byte of w
+		for (; n > 0; n--, w >>= 8) {
+			q[0] = digits[(w >> 4) & 0xF];
+			q[1] = digits[w & 0xF];
+			q += 2;
+			if (sep)
+				*q++ = sep;
+		}
+		if (len == 0 && sep)
+			q--;
+		if (len == 0 || q + 12 > buf + sizeof(buf)) {
+			putrun(putch, putbuf, putdat, buf, q - buf);
+			q = buf;
+		}
+	}
 }
 
 // Get an unsigned int of various possible sizes from a varargs list,
@@ -77,173 +175,355 @@ getint(va_list *ap, int lflag)
 }
 
 
+// One %-escape sequence, parsed
+struct fmtspec {
+	int conv;		// conversion character
+	char padc;
+	int width;
+	int precision;
+	int lflag;
+	int altflag;
+	char ext;		// 'h' for %ph, 'N' for %phN, else 0
+};
+
+// The conversions printarg knows; anything else is printed literally.
+static const char conversions[] = "Ccesduopx%";
+
+// Parse the escape sequence that starts just after a '%' at *fmt,
+// leaving *fmt past its conversion character.  A '*' width or
+// precision is taken from ap, or reads as 0 if ap is NULL.
+// Returns 1 if the escape used '*', 0 if not.
+static int
+parsespec(const char **fmt, struct fmtspec *sp, va_list *ap)
+{
+	const char *f = *fmt;
+	int ch, star = 0;
+
+	sp->padc = ' ';
+	sp->width = -1;
+	sp->precision = -1;
+	sp->lflag = 0;
+	sp->altflag = 0;
+	sp->ext = 0;
+reswitch:
+	switch (ch = *(unsigned char *) f++) {
+	// flag to pad on the right
+	case '-':
+		sp->padc = '-';
+		goto reswitch;
+
+	// flag to pad with 0's instead of spaces
+	case '0':
+		sp->padc = '0';
+		goto reswitch;
+
+	// width field
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '5':
+	case '6':
+	case '7':
+	case '8':
+	case '9':
+		for (sp->precision = 0; ; ++f) {
+			sp->precision = sp->precision * 10 + ch - '0';
+			ch = *f;
+			if (ch < '0' || ch > '9')
+				break;
+		}
+		goto process_precision;
+
+	case '*':
+		sp->precision = ap ? va_arg(*ap, int) : 0;
+		star = 1;
+		goto process_precision;
+
+	case '.':
+		if (sp->width < 0)
+			sp->width = 0;
+		goto reswitch;
+
+	case '#':
+		sp->altflag = 1;
+		goto reswitch;
+
+	process_precision:
+		if (sp->width < 0)
+			sp->width = sp->precision, sp->precision = -1;
+		goto reswitch;
+
+	// long flag (doubled for long long)
+	case 'l':
+		sp->lflag++;
+		goto reswitch;
+	}
+	if (ch == 'p' && *f == 'h') {
+		sp->ext = (f[1] == 'N' ? 'N' : 'h');
+		f += (sp->ext == 'N' ? 2 : 1);
+	}
+	sp->conv = ch;
+	*fmt = f;
+	return star;
+}
+
+// Print the next argument from ap as sp describes.  Returns -1 without
+// printing anything if sp's conversion is not in conversions[].
+static int
+printarg(void (*putch)(int, void*), void (*putbuf)(const char*, size_t, void*),
+	 void *putdat, const struct fmtspec *sp, va_list *ap)
+{
+	const char *p;
+	int ch, err;
+	unsigned long long num;
+	int base;
+	int width = sp->width, precision = sp->precision;
+	size_t len;
+
+	switch (sp->conv) {
+	// Set color
+	case 'C':
+		textcolor = va_arg(*ap, int);
+		break;
+
+	// character
+	case 'c':
+		putch(va_arg(*ap, int), putdat);
+		break;
+
+	// error message
+	case 'e':
+		err = va_arg(*ap, int);
+		if (err < 0)
+			err = -err;
+		if (err >= MAXERROR || (p = error_string[err]) == NULL)
+			printfmt(putch, putdat, "error %d", err);
+		else
+			printfmt(putch, putdat, "%s", p);
+		break;
+
+	// string
+	case 's':
+		if ((p = va_arg(*ap, char *)) == NULL)
+			p = "(null)";
+		len = strnlen(p, precision);
+		if (width > 0 && sp->padc != '-')
+			for (width -= len; width > 0; width--)
+				putch(sp->padc, putdat);
+		if (sp->altflag) {
+			for (; (ch = *p++) != '\0' && (precision < 0 || --precision >= 0); width--)
+				if (ch < ' ' || ch > '~')
+					putch('?', putdat);
+				else
+					putch(ch, putdat);
+		} else {
+			putrun(putch, putbuf, putdat, p, len);
+			width -= len;
+		}
+		for (; width > 0; width--)
+			putch(' ', putdat);
+		break;
+
+	// (signed) decimal
+	case 'd':
+		num = getint(ap, sp->lflag);
+		if ((long long) num < 0) {
+			putch('-', putdat);
+			num = -(long long) num;
+		}
+		base = 10;
+		goto number;
+
+	// unsigned decimal
+	case 'u':
+		num = getuint(ap, sp->lflag);
+		base = 10;
+		goto number;
+
+	// (unsigned) octal
+	case 'o':
+		// Replace this with your code.
+		num = getuint(ap, sp->lflag);
+		base = 8;
+		goto number;
+
+	// pointer, or hex dump of what it points to
+	case 'p':
+		if (sp->ext) {
+			printhex(putch, putbuf, putdat, va_arg(*ap, void *),
+				 width < 0 ? 1 : width, sp->ext == 'h' ? ' ' : 0);
+			break;
+		}
+		putch('0', putdat);
+		putch('x', putdat);
+		num = (unsigned long long)
+			(uintptr_t) va_arg(*ap, void *);
+		base = 16;
+		goto number;
+
+	// (unsigned) hexadecimal
+	case 'x':
+		num = getuint(ap, sp->lflag);
+		base = 16;
+	number:
+		printnum(putch, putbuf, putdat, num, base, width, sp->padc);
+		break;
+
+	// escaped '%' character
+	case '%':
+		putch('%', putdat);
+		break;
+
+	default:
+		return -1;
+	}
+	return 0;
+}
+
 // Main function to format and print a string.
 void printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
 
 void
 vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
+{
+	vprintfmt_bulk(putch, NULL, putdat, fmt, ap);
+}
+
+// Like vprintfmt, but if putbuf is not NULL, the literal text between
+// escapes, %s strings and the digits of numbers go to putbuf a run at
+// a time.  putch still gets single characters such as padding.
+void
+vprintfmt_bulk(void (*putch)(int, void*),
+	       void (*putbuf)(const char*, size_t, void*),
+	       void *putdat, const char *fmt, va_list ap)
 {
 	register const char *p;
-	register int ch, err;
-	unsigned long long num;
-	int base, lflag, width, precision, altflag;
-	char padc;
+	struct fmtspec spec;
 
 	while (1) {
-		while ((ch = *(unsigned char *) fmt++) != '%') {
-			if (ch == '\0')
-				return;
-			putch(ch, putdat);
+		for (p = fmt; *fmt != '%' && *fmt != '\0'; fmt++)
+			/* do nothing */;
+		putrun(putch, putbuf, putdat, p, fmt - p);
+		if (*fmt++ == '\0')
+			return;
+
+		// Process a %-escape sequence; an unrecognized one is
+		// printed literally
+		p = fmt;
+		parsespec(&fmt, &spec, &ap);
+		if (printarg(putch, putbuf, putdat, &spec, &ap) < 0) {
+			putch('%', putdat);
+			fmt = p;
 		}
+	}
+}
 
-		// Process a %-escape sequence
-		padc = ' ';
-		width = -1;
-		precision = -1;
-		lflag = 0;
-		altflag = 0;
-	reswitch:
-		switch (ch = *(unsigned char *) fmt++) {
-		// Set color
-		case 'C':
-			textcolor = va_arg(ap, int);
-			break;
-
-		// flag to pad on the right
-		case '-':
-			padc = '-';
-			goto reswitch;
-
-		// flag to pad with 0's instead of spaces
-		case '0':
-			padc = '0';
-			goto reswitch;
-
-		// width field
-		case '1':
-		case '2':
-		case '3':
-		case '4':
-		case '5':
-		case '6':
-		case '7':
-		case '8':
-		case '9':
-			for (precision = 0; ; ++fmt) {
-				precision = precision * 10 + ch - '0';
-				ch = *fmt;
-				if (ch < '0' || ch > '9')
-					break;
-			}
-			goto process_precision;
-
-		case '*':
-			precision = va_arg(ap, int);
-			goto process_precision;
-
-		case '.':
-			if (width < 0)
-				width = 0;
-			goto reswitch;
-
-		case '#':
-			altflag = 1;
-			goto reswitch;
-
-		process_precision:
-			if (width < 0)
-				width = precision, precision = -1;
-			goto reswitch;
-
-		// long flag (doubled for long long)
-		case 'l':
-			lflag++;
-			goto reswitch;
-
-		// character
-		case 'c':
-			putch(va_arg(ap, int), putdat);
-			break;
+// Compile fmt into fc->fc_ops.  A format that needs more than
+// FMT_MAXOPS ops is marked with fc_nops = -1 and is parsed afresh
+// on every call instead.
+static void
+fmtcompile(struct Fmtcache *fc, const char *fmt)
+{
+	struct Fmtop *op = fc->fc_ops;
+	struct Fmtop *end = fc->fc_ops + FMT_MAXOPS;
+	struct fmtspec spec;
+	const char *p, *start = fmt;
+	int star;
 
-		// error message
-		case 'e':
-			err = va_arg(ap, int);
-			if (err < 0)
-				err = -err;
-			if (err >= MAXERROR || (p = error_string[err]) == NULL)
-				printfmt(putch, putdat, "error %d", err);
-			else
-				printfmt(putch, putdat, "%s", p);
+	while (1) {
+		for (p = fmt; *fmt != '%' && *fmt != '\0'; fmt++)
+			/* do nothing */;
+		if (fmt - p > 0xFFFF)
+			goto toobig;
+		if (fmt > p) {
+			if (op == end)
+				goto toobig;
+			op->fo_str = p;
+			op->fo_len = fmt - p;
+			op->fo_conv = 0;
+			op++;
+		}
+		if (*fmt++ == '\0')
 			break;
 
-		// string
-		case 's':
-			if ((p = va_arg(ap, char *)) == NULL)
-				p = "(null)";
-			if (width > 0 && padc != '-')
-				for (width -= strnlen(p, precision); width > 0; width--)
-					putch(padc, putdat);
-			for (; (ch = *p++) != '\0' && (precision < 0 || --precision >= 0); width--)
-				if (altflag && (ch < ' ' || ch > '~'))
-					putch('?', putdat);
-				else
-					putch(ch, putdat);
-			for (; width > 0; width--)
-				putch(' ', putdat);
-			break;
+		if (op == end)
+			goto toobig;
+		p = fmt;
+		star = parsespec(&fmt, &spec, NULL);
+		if (spec.conv == '\0' || strchr(conversions, spec.conv) == NULL) {
+			// Unrecognized: print the '%', then carry on
+			// with the text right after it
+			op->fo_str = p - 1;
+			op->fo_len = 1;
+			op->fo_conv = 0;
+			fmt = p;
+		} else if (star || spec.width != (int16_t) spec.width
+			   || spec.precision != (int16_t) spec.precision) {
+			// Takes its width from the arguments (or won't
+			// fit in an op): parse the escape again each time
+			op->fo_str = p;
+			op->fo_len = 0;
+			op->fo_conv = '*';
+		} else {
+			op->fo_str = p;
+			op->fo_len = 0;
+			op->fo_conv = spec.conv;
+			op->fo_padc = spec.padc;
+			op->fo_lflag = spec.lflag;
+			op->fo_altflag = spec.altflag;
+			op->fo_ext = spec.ext;
+			op->fo_width = spec.width;
+			op->fo_precision = spec.precision;
+		}
+		op++;
+	}
+	fc->fc_nops = op - fc->fc_ops;
+	fc->fc_fmt = start;
+	return;
 
-		// (signed) decimal
-		case 'd':
-			num = getint(&ap, lflag);
-			if ((long long) num < 0) {
-				putch('-', putdat);
-				num = -(long long) num;
-			}
-			base = 10;
-			goto number;
-
-		// unsigned decimal
-		case 'u':
-			num = getuint(&ap, lflag);
-			base = 10;
-			goto number;
-
-		// (unsigned) octal
-		case 'o':
-			// Replace this with your code.
-			num = getuint(&ap, lflag);
-			base = 8;
-			goto number;
-
-		// pointer
-		case 'p':
-			putch('0', putdat);
-			putch('x', putdat);
-			num = (unsigned long long)
-				(uintptr_t) va_arg(ap, void *);
-			base = 16;
-			goto number;
-
-		// (unsigned) hexadecimal
-		case 'x':
-			num = getuint(&ap, lflag);
-			base = 16;
-		number:
-			printnum(putch, putdat, num, base, width, padc);
-			break;
+toobig:
+	fc->fc_nops = -1;
+	fc->fc_fmt = start;
+}
 
-		// escaped '%' character
-		case '%':
-			putch(ch, putdat);
-			break;
+// Like vprintfmt_bulk, but fmt is compiled into fc the first time
+// through, so later calls with the same fmt only run the ops.
+// fmt must not change while fc holds it: pass string literals only.
+void
+vprintfmt_cached(void (*putch)(int, void*),
+		 void (*putbuf)(const char*, size_t, void*),
+		 void *putdat, struct Fmtcache *fc, const char *fmt, va_list ap)
+{
+	const struct Fmtop *op;
+	struct fmtspec spec;
+	const char *p;
+
+	if (fc->fc_fmt != fmt)
+		fmtcompile(fc, fmt);
+	if (fc->fc_nops < 0) {
+		vprintfmt_bulk(putch, putbuf, putdat, fmt, ap);
+		return;
+	}
 
-		// unrecognized escape sequence - just print it literally
-		default:
-			putch('%', putdat);
-			for (fmt--; fmt[-1] != '%'; fmt--)
-				/* do nothing */;
-			break;
+	for (op = fc->fc_ops; op < fc->fc_ops + fc->fc_nops; op++) {
+		if (op->fo_len > 0) {
+			putrun(putch, putbuf, putdat, op->fo_str, op->fo_len);
+			continue;
+		}
+		if (op->fo_conv == '*') {
+			p = op->fo_str;
+			parsespec(&p, &spec, &ap);
+		} else {
+			spec.conv = op->fo_conv;
+			spec.padc = op->fo_padc;
+			spec.width = op->fo_width;
+			spec.precision = op->fo_precision;
+			spec.lflag = op->fo_lflag;
+			spec.altflag = op->fo_altflag;
+			spec.ext = op->fo_ext;
 		}
+		printarg(putch, putbuf, putdat, &spec, &ap);
 	}
 }
 
@@ -271,6 +551,16 @@ sprintputch(int ch, struct sprintbuf *b)
 		*b->buf++ = ch;
 }
 
+static void
+sprintputbuf(const char *s, size_t len, struct sprintbuf *b)
+{
+	size_t n = MIN(len, (size_t) (b->ebuf - b->buf));
+
+	b->cnt += len;
+	memcpy(b->buf, s, n);
+	b->buf += n;
+}
+
 int
 vsnprintf(char *buf, int n, const char *fmt, va_list ap)
 {
@@ -280,7 +570,7 @@ vsnprintf(char *buf, int n, const char *fmt, va_list ap)
 		return -E_INVAL;
 
 	// print the string to the buffer
-	vprintfmt((void*)sprintputch, &b, fmt, ap);
+	vprintfmt_bulk((void*)sprintputch, (void*)sprintputbuf, &b, fmt, ap);
 
 	// null terminate the buffer
 	*b.buf = '\0';
@@ -8,6 +8,28 @@
 // Primespipe runs 3x faster this way.
 #define ASM 1
 
+#ifdef JOS_KERNEL
+#include <inc/x86.h>
+#include <inc/mmu.h>
+
+// The kernel picks faster loops for big buffers once string_init()
+// has asked CPUID what the CPU has.
+static bool string_sse2;	// 16-byte SSE2 loops
+static bool string_erms;	// fast 'rep movsb/stosb' (ERMS)
+
+// Buffers smaller than this aren't worth the setup of the above
+#define STR_BIG		64
+
+// The kernel doesn't save the XMM registers on a trap, so the SSE2 loops
+// run with interrupts masked.  They do at most this many bytes per cli
+// so as not to hold off interrupts for long.
+#define SSE_CHUNK	4096
+
+static void sse_memset(void *v, int c, size_t n);
+static void sse_memmove(void *dst, const void *src, size_t n);
+static size_t sse_mismatch(const void *v1, const void *v2, size_t n);
+#endif
+
 int
 strlen(const char *s)
 {
@@ -125,15 +147,27 @@ memset(void *v, int c, size_t n)
 
 	if (n == 0)
 		return v;
+#ifdef JOS_KERNEL
+	if (n >= STR_BIG && string_erms) {
+		asm volatile("cld; rep stosb\n"
+			: "=D" (p), "=c" (n) : "0" (v), "a" (c), "1" (n)
+			: "cc", "memory");
+		return v;
+	}
+	if (n >= STR_BIG && string_sse2) {
+		sse_memset(v, c, n);
+		return v;
+	}
+#endif
 	if ((int)v%4 == 0 && n%4 == 0) {
 		c &= 0xFF;
 		c = (c<<24)|(c<<16)|(c<<8)|c;
 		asm volatile("cld; rep stosl\n"
-			:: "D" (v), "a" (c), "c" (n/4)
+			: "=D" (p), "=c" (n) : "0" (v), "a" (c), "1" (n/4)
 			: "cc", "memory");
 	} else
 		asm volatile("cld; rep stosb\n"
-			:: "D" (v), "a" (c), "c" (n)
+			: "=D" (p), "=c" (n) : "0" (v), "a" (c), "1" (n)
 			: "cc", "memory");
 	return v;
 }
@@ -146,24 +180,39 @@ memmove(void *dst, const void *src, size_t n)
 
 	s = src;
 	d = dst;
+#ifdef JOS_KERNEL
+	// 'rep movsb' is only fast going forwards
+	if (n >= STR_BIG && string_erms && !(s < d && s + n > d)) {
+		asm volatile("cld; rep movsb\n"
+			: "+D" (d), "+S" (s), "+c" (n) :: "cc", "memory");
+		return dst;
+	}
+	if (n >= STR_BIG && string_sse2) {
+		sse_memmove(d, s, n);
+		return dst;
+	}
+#endif
 	if (s < d && s + n > d) {
 		s += n;
 		d += n;
 		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
 			asm volatile("std; rep movsl\n"
-				:: "D" (d-4), "S" (s-4), "c" (n/4) : "cc", "memory");
+				: "=D" (d), "=S" (s), "=c" (n)
+				: "0" (d-4), "1" (s-4), "2" (n/4) : "cc", "memory");
 		else
 			asm volatile("std; rep movsb\n"
-				:: "D" (d-1), "S" (s-1), "c" (n) : "cc", "memory");
+				: "=D" (d), "=S" (s), "=c" (n)
+				: "0" (d-1), "1" (s-1), "2" (n) : "cc", "memory");
 		// Some versions of GCC rely on DF being clear
 		asm volatile("cld" ::: "cc");
 	} else {
 		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
 			asm volatile("cld; rep movsl\n"
-				:: "D" (d), "S" (s), "c" (n/4) : "cc", "memory");
+				: "=D" (d), "=S" (s), "=c" (n)
+				: "0" (d), "1" (s), "2" (n/4) : "cc", "memory");
 		else
 			asm volatile("cld; rep movsb\n"
-				:: "D" (d), "S" (s), "c" (n) : "cc", "memory");
+				: "+D" (d), "+S" (s), "+c" (n) :: "cc", "memory");
 	}
 	return dst;
 }
@@ -217,6 +266,15 @@ memcmp(const void *v1, const void *v2, size_t n)
 	const uint8_t *s1 = (const uint8_t *) v1;
 	const uint8_t *s2 = (const uint8_t *) v2;
 
+#ifdef JOS_KERNEL
+	// Skip the 16-byte blocks that match
+	if (n >= STR_BIG && string_sse2) {
+		size_t off = sse_mismatch(s1, s2, n);
+		s1 += off;
+		s2 += off;
+		n -= off;
+	}
+#endif
 	while (n-- > 0) {
 		if (*s1 != *s2)
 			return (int) *s1 - (int) *s2;
@@ -283,3 +341,198 @@ strtol(const char *s, char **endptr, int base)
 	return (neg ? -val : val);
 }
 
+
+#ifdef JOS_KERNEL
+
+// CPUID feature bits
+#define CPUID_1_EDX_FXSR	(1 << 24)	// leaf 1: FXSAVE/FXRSTOR
+#define CPUID_1_EDX_SSE2	(1 << 26)	// leaf 1: SSE2
+#define CPUID_7_EBX_ERMS	(1 << 9)	// leaf 7: fast rep movsb/stosb
+
+// Pick the loops memset, memmove and memcmp use for big buffers.
+// Turns SSE on if the CPU has SSE2, so call it once at boot, before
+// anything else could be using the XMM registers.
+void
+string_init(void)
+{
+	uint32_t max, ebx, edx;
+
+	cpuid(0, &max, NULL, NULL, NULL);
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if ((edx & CPUID_1_EDX_FXSR) && (edx & CPUID_1_EDX_SSE2)) {
+		lcr0((rcr0() & ~(CR0_EM | CR0_TS)) | CR0_MP);
+		lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+		string_sse2 = true;
+	}
+	if (max >= 7) {
+		cpuid(7, NULL, &ebx, NULL, NULL);
+		string_erms = !!(ebx & CPUID_7_EBX_ERMS);
+	}
+}
+
+// The SSE2 loops below need n >= 16.  Each does its unaligned first and
+// last 16 bytes separately and aligned 16-byte stores in between.
+// The kernel is compiled with -mno-sse (see KERN_CFLAGS), so GCC keeps
+// nothing in the XMM registers and they needn't (and can't) be listed
+// as clobbered.
+
+// Fill n bytes at p with the byte repeated in w.
+static void
+sse_set(char *p, uint32_t w, size_t n)
+{
+	char *a = (char *) (((uintptr_t) p + 16) & ~15);
+	char *e = (char *) (((uintptr_t) p + n) & ~15);
+
+	asm volatile("movd %[w], %%xmm0\n"
+		     "\tpshufd $0, %%xmm0, %%xmm0\n"
+		     "\tmovdqu %%xmm0, (%[p])\n"
+		     "\tmovdqu %%xmm0, -16(%[p],%[n])\n"
+		     "\tjmp 2f\n"
+		     "1:\tmovdqa %%xmm0, (%[a])\n"
+		     "\tadd $16, %[a]\n"
+		     "2:\tcmp %[e], %[a]\n"
+		     "\tjb 1b\n"
+		     : [a] "+r" (a)
+		     : [e] "r" (e), [w] "r" (w), [p] "r" (p), [n] "r" (n)
+		     : "cc", "memory");
+}
+
+// Copy n bytes from s to d, lowest address first.  The first and
+// last 16 bytes are loaded before anything is stored, so d may
+// overlap s if d is below it.
+static void
+sse_copy_up(char *d, const char *s, size_t n)
+{
+	size_t off = 16 - ((uintptr_t) d & 15);
+
+	asm volatile("movdqu (%[s]), %%xmm0\n"
+		     "\tmovdqu -16(%[s],%[n]), %%xmm1\n"
+		     "\tsub $16, %[n]\n"
+		     "\tjmp 2f\n"
+		     "1:\tmovdqu (%[s],%[off]), %%xmm2\n"
+		     "\tmovdqa %%xmm2, (%[d],%[off])\n"
+		     "\tadd $16, %[off]\n"
+		     "2:\tcmp %[n], %[off]\n"
+		     "\tjbe 1b\n"
+		     "\tmovdqu %%xmm0, (%[d])\n"
+		     "\tmovdqu %%xmm1, (%[d],%[n])\n"
+		     : [off] "+r" (off), [n] "+r" (n)
+		     : [d] "r" (d), [s] "r" (s)
+		     : "cc", "memory");
+}
+
+// Copy n bytes from s to d, highest address first, so d may overlap
+// s if d is above it.
+static void
+sse_copy_down(char *d, const char *s, size_t n)
+{
+	int off = n - ((uintptr_t) (d + n) & 15) - 16;
+
+	asm volatile("movdqu (%[s]), %%xmm0\n"
+		     "\tmovdqu -16(%[s],%[n]), %%xmm1\n"
+		     "\tjmp 2f\n"
+		     "1:\tmovdqu (%[s],%[off]), %%xmm2\n"
+		     "\tmovdqa %%xmm2, (%[d],%[off])\n"
+		     "\tsub $16, %[off]\n"
+		     "2:\ttest %[off], %[off]\n"
+		     "\tjg 1b\n"
+		     "\tmovdqu %%xmm0, (%[d])\n"
+		     "\tmovdqu %%xmm1, -16(%[d],%[n])\n"
+		     : [off] "+r" (off)
+		     : [d] "r" (d), [s] "r" (s), [n] "r" (n)
+		     : "cc", "memory");
+}
+
+// Offset of the first 16-byte block that differs between a and b,
+// or n if none does.  n must be a multiple of 16.
+static size_t
+sse_cmp(const char *a, const char *b, size_t n)
+{
+	size_t off = 0;
+	uint32_t mask;
+
+	asm volatile("jmp 2f\n"
+		     "1:\tmovdqu (%[a],%[off]), %%xmm0\n"
+		     "\tmovdqu (%[b],%[off]), %%xmm1\n"
+		     "\tpcmpeqb %%xmm1, %%xmm0\n"
+		     "\tpmovmskb %%xmm0, %[mask]\n"
+		     "\tcmp $0xFFFF, %[mask]\n"
+		     "\tjne 3f\n"
+		     "\tadd $16, %[off]\n"
+		     "2:\tcmp %[n], %[off]\n"
+		     "\tjb 1b\n"
+		     "3:\n"
+		     : [off] "+r" (off), [mask] "=&r" (mask)
+		     : [a] "r" (a), [b] "r" (b), [n] "r" (n)
+		     : "cc", "memory");
+	return off;
+}
+
+// The SSE2 memset, memmove and memcmp: SSE_CHUNK bytes at a time with
+// interrupts masked.  A short last chunk is merged into the one before
+// it so that every chunk has at least 16 bytes.
+
+static void
+sse_memset(void *v, int c, size_t n)
+{
+	char *p = v;
+	uint32_t w = (c & 0xFF) * 0x01010101, eflags;
+	size_t m;
+
+	for (; n > 0; p += m, n -= m) {
+		m = (n < 2 * SSE_CHUNK ? n : SSE_CHUNK);
+		eflags = read_eflags();
+		asm volatile("cli");
+		sse_set(p, w, m);
+		write_eflags(eflags);
+	}
+}
+
+static void
+sse_memmove(void *dst, const void *src, size_t n)
+{
+	const char *s = src;
+	char *d = dst;
+	uint32_t eflags;
+	size_t m;
+
+	if (s < d && s + n > d)
+		for (; n > 0; n -= m) {
+			m = (n < 2 * SSE_CHUNK ? n : SSE_CHUNK);
+			eflags = read_eflags();
+			asm volatile("cli");
+			sse_copy_down(d + n - m, s + n - m, m);
+			write_eflags(eflags);
+		}
+	else
+		for (; n > 0; d += m, s += m, n -= m) {
+			m = (n < 2 * SSE_CHUNK ? n : SSE_CHUNK);
+			eflags = read_eflags();
+			asm volatile("cli");
+			sse_copy_up(d, s, m);
+			write_eflags(eflags);
+		}
+}
+
+// How many leading bytes of v1 and v2 are known to match, a multiple
+// of 16; memcmp finishes the job from there.
+static size_t
+sse_mismatch(const void *v1, const void *v2, size_t n)
+{
+	const char *a = v1, *b = v2;
+	uint32_t eflags;
+	size_t off, m, r;
+
+	for (off = 0; n - off >= 16; off += m) {
+		m = MIN(n - off, SSE_CHUNK) & ~15;
+		eflags = read_eflags();
+		asm volatile("cli");
+		r = sse_cmp(a + off, b + off, m);
+		write_eflags(eflags);
+		if (r < m)
+			return off + r;
+	}
+	return off;
+}
+
+#endif	// JOS_KERNEL